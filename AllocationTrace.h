@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+
+// binary allocation trace: one AllocationTraceHeader, then fixed-size records in the order they were flushed,
+// which is only chronological per thread; replaying merges the threads by timestamp
+enum class TraceOp : uint16_t
+{
+    Malloc = 1,
+    Calloc, // size is the total, count*size
+    Realloc, // oldPtr is the blk passed in, 0 for realloc(nullptr, size)
+    AlignedAlloc, // aligned_alloc, posix_memalign and memalign alike
+    Free,
+};
+
+constexpr char TRACE_MAGIC[8] = {'S', 'B', 'R', 'K', 'T', 'R', 'C', '\0'};
+constexpr uint32_t TRACE_VERSION = 1;
+
+struct AllocationTraceHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t recordSize; // readers step by this, so records can grow at the end
+};
+
+struct AllocationTraceRecord
+{
+    uint64_t timestampNanos; // steady clock, only differences are meaningful
+    uint64_t ptr; // blk returned or freed; an id only, an address comes back once it is freed
+    uint64_t oldPtr;
+    uint64_t size; // as requested
+    uint32_t threadId; // small per-process numbers in the order threads first allocated
+    TraceOp op;
+    uint16_t alignmentLog2; // AlignedAlloc only
+};
+static_assert(sizeof(AllocationTraceRecord) == 40);
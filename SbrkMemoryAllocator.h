@@ -0,0 +1,3260 @@
+#pragma once
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cerrno>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <chrono>
+#include <memory_resource>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <unwind.h>
+#include <linux/mempolicy.h>
+#include <sys/mman.h>
+#include <sys/random.h>
+#include <sys/syscall.h>
+#include "AllocationTrace.h"
+
+// where a heap request is placed among the free blks that could hold it, picked at compile time;
+// slab objects, thread caches and mmap'd blks are not affected
+struct Placement
+{
+    struct FirstFit {}; // first fitting blk of the size class, most recently freed first
+    struct NextFit {}; // like FirstFit, but each scan of a size class resumes where the last one stopped
+    struct BestFit {}; // smallest fitting blk, large size classes are indexed by size-keyed tries
+    struct AddressOrderedFirstFit {}; // size classes kept sorted by address, lowest fitting blk wins
+};
+
+// how the allocator's locks are taken; None is for single-threaded programs only
+struct Locking
+{
+    struct None {};
+    struct Spin {}; // test and test-and-set, yielding the cpu while contended
+    struct Mutex {}; // std::mutex
+};
+
+// compile-time tuning, passed as SbrkMemoryAllocator's second parameter; derive from it and override what
+// differs, e.g. struct Embedded : AllocatorConfig { using LockPolicy = Locking::None; constexpr static bool STATS = false; };
+struct AllocatorConfig
+{
+    using LockPolicy = Locking::Mutex;
+    constexpr static bool STATS = true; // call, split/merge and syscall counts; footprint and free lists are always reported
+
+    // size classes: exact bins per 16 bytes below 1 << SMALL_BIN_LIMIT_LOG2, which thread caches cover as well,
+    // then LARGE_BINS_PER_POW2 ranged bins per power of two; the last of NUM_BINS takes everything above
+    constexpr static size_t SMALL_BIN_LIMIT_LOG2 = 9; // 512B
+    constexpr static size_t LARGE_BINS_PER_POW2 = 4;
+    constexpr static size_t NUM_BINS = 128;
+
+    constexpr static size_t DEFAULT_MMAP_THRESHOLD = 128*1024; // 128KB
+    constexpr static size_t MMAP_THRESHOLD_MAX = 512*1024; // 512KB, a heap blk this large must still fit an arena chunk
+    constexpr static size_t DEFAULT_TRIM_THRESHOLD = 512*1024; // 512KB, well above a growth step to avoid grow/trim cycles
+    constexpr static size_t DEFAULT_HEAP_GROWTH = 128*1024; // 128KB
+    constexpr static size_t DEFAULT_MAPPING_CACHE_LIMIT = 32*1024*1024; // 32MB
+    constexpr static uint32_t TCACHE_DEFAULT_LIMIT = 16;
+};
+
+template <typename PlacementPolicy = Placement::FirstFit, typename Config = AllocatorConfig>
+class SbrkMemoryAllocator
+{
+private:
+    // every size is a multiple of SIZE_GRANULE, which leaves the low bits of the size word for flags
+    constexpr static size_t SIZE_GRANULE = 16;
+    constexpr static size_t FLAG_FREE = 1;
+    constexpr static size_t FLAG_PREV_FREE = 2; // the blk physically before this one is free
+    constexpr static size_t FLAG_MMAPPED = 4;
+    constexpr static size_t FLAG_NON_MAIN_ARENA = 8; // lives in an mmap'd arena chunk rather than the sbrk heap
+    constexpr static size_t FLAG_SAMPLED = FLAG_PREV_FREE; // mmap'd blks have no previous blk, so the profiler takes the bit
+    constexpr static size_t FLAG_MASK = SIZE_GRANULE-1;
+    // SBRK_HARDENED builds mask the singly linked free lists with their slot address (safe-linking), keep a
+    // keyed checksum of each header in the top bits of its size word and check frees for doubles;
+    // SBRK_CANARIES builds put a keyed canary right after every request, checked when the blk is freed
+#ifdef SBRK_HARDENED
+    constexpr static bool HARDENED = true;
+#else
+    constexpr static bool HARDENED = false;
+#endif
+#ifdef SBRK_CANARIES
+    constexpr static bool CANARIES = true;
+#else
+    constexpr static bool CANARIES = false;
+#endif
+    constexpr static size_t CHECK_MASK = HARDENED ? ~size_t{0} << 48 : 0; // sizes never reach 2^48
+    constexpr static size_t SIZE_MASK = ~(FLAG_MASK | CHECK_MASK);
+    constexpr static size_t CANARY_SIZE = CANARIES ? 16 : 0; // the canary, and the requested size in the blk's last word
+    // headers, granule and segment starts are all 16 byte aligned, so every payload is too
+    static_assert(alignof(std::max_align_t) <= SIZE_GRANULE);
+
+    // physical neighbours are found by address: the next blk starts right after the payload and the
+    // previous one is located through the boundary tag; every segment ends in a zero-sized fencepost
+    struct MemoryBlock
+    {
+        size_t prevSize; // boundary tag: size of the adjacent previous blk, valid only with FLAG_PREV_FREE
+        size_t sizeAndFlags; // payload size, flags in the low bits
+
+        // only written under the arena lock, but free() reads the word of any blk unlocked to find its owner
+        size_t load() const { return std::atomic_ref(const_cast<size_t&>(sizeAndFlags)).load(std::memory_order_relaxed); }
+        void store(size_t word) { std::atomic_ref(sizeAndFlags).store(sealHeader(this, word), std::memory_order_relaxed); }
+
+        size_t size() const { return load() & SIZE_MASK; }
+        void setSize(size_t size) { store(size | (load() & FLAG_MASK)); }
+        bool hasFlag(size_t flag) const { return load() & flag; }
+        void setFlag(size_t flag, bool on) { store(on ? load()|flag : load()&~flag); }
+    };
+
+    // free blks keep their list links in the payload, allocated blks only pay for the header
+    struct FreeLinks
+    {
+        MemoryBlock* nextFree; // next blk in free list
+        MemoryBlock* prevFree; // prev blk in free list
+    };
+
+    // with BestFit every large size class is a bitwise trie on the size bits below the ones the class
+    // fixes, as in dlmalloc's treebins; blks of a size already in the trie queue behind that node
+    struct TreeLinks
+    {
+        FreeLinks list; // queue of same-sized blks, only the head is a tree node
+        MemoryBlock* child[2];
+        MemoryBlock* parent; // nullptr for the root
+        bool inTree; // false while queued behind a node
+    };
+
+    // mmap'd blks never join a heap, so they only need the mapping start next to the flags
+    struct MmapBlock
+    {
+        size_t mappingOffset; // distance from the start of the mapping to this header, non-zero when aligned
+        size_t sizeAndFlags; // same position as in MemoryBlock so free() can tell them apart
+    };
+    static_assert(sizeof(MmapBlock) == sizeof(MemoryBlock));
+    static_assert(offsetof(MmapBlock, sizeAndFlags) == offsetof(MemoryBlock, sizeAndFlags));
+
+    // a mapping released by free() and kept for reuse, the node lives in its own first page
+    struct CachedMapping
+    {
+        CachedMapping* nextInClass;
+        CachedMapping* prevInClass;
+        CachedMapping* newer; // age list, newest first
+        CachedMapping* older;
+        size_t length;
+        std::chrono::steady_clock::time_point releasedAt;
+    };
+
+    // a sampled blk always gets a mapping of its own, with this record right before the header
+    constexpr static size_t MAX_STACK_DEPTH = 32;
+    struct alignas(SIZE_GRANULE) SampleRecord
+    {
+        SampleRecord* next; // live samples, newest first
+        SampleRecord* prev;
+        size_t size;
+        uint64_t timestampNanos;
+        size_t depth;
+        void* stack[MAX_STACK_DEPTH];
+    };
+
+    // a thread's allocation trace on its way to the file; the thread appends at head, the flusher consumes
+    // up to it, and the counters only ever grow
+    constexpr static size_t TRACE_RING_RECORDS = 65536; // 2.5MB, mapped on the thread's first traced call
+    struct TraceRing
+    {
+        TraceRing* next; // every ring, guarded by traceMutex
+        uint32_t threadId;
+        std::atomic<bool> abandoned{false}; // the thread exited, unmapped once drained
+        alignas(64) std::atomic<uint64_t> head{0};
+        alignas(64) std::atomic<uint64_t> tail{0};
+        AllocationTraceRecord records[TRACE_RING_RECORDS];
+    };
+
+    constexpr static size_t MIN_PAYLOAD_SIZE = sizeof(FreeLinks);
+    constexpr static size_t MIN_USEABLE_SIZE = sizeof(MemoryBlock)+MIN_PAYLOAD_SIZE;
+
+    constexpr static size_t DEFAULT_MMAP_THRESHOLD = Config::DEFAULT_MMAP_THRESHOLD;
+    constexpr static size_t MMAP_THRESHOLD_MAX = Config::MMAP_THRESHOLD_MAX;
+    constexpr static size_t DEFAULT_MAPPING_CACHE_LIMIT = Config::DEFAULT_MAPPING_CACHE_LIMIT;
+    constexpr static std::chrono::milliseconds DEFAULT_MAPPING_CACHE_DECAY{1000};
+    constexpr static size_t PROFILE_RECHECK_BYTES = 1024*1024; // 1MB, how often threads look at a disabled profiler
+
+    // size classes: exact small bins per SIZE_GRANULE, then LARGE_BINS_PER_POW2 ranged bins per power of two
+    constexpr static size_t SMALL_BIN_LIMIT_LOG2 = Config::SMALL_BIN_LIMIT_LOG2;
+    constexpr static size_t SMALL_BIN_LIMIT = 1ULL << SMALL_BIN_LIMIT_LOG2;
+    constexpr static size_t NUM_SMALL_BINS = SMALL_BIN_LIMIT/SIZE_GRANULE;
+    constexpr static size_t LARGE_BINS_PER_POW2 = Config::LARGE_BINS_PER_POW2;
+    constexpr static size_t LARGE_BINS_LOG2 = std::countr_zero(LARGE_BINS_PER_POW2);
+    constexpr static bool USE_TREE_BINS = std::is_same_v<PlacementPolicy, Placement::BestFit>;
+    constexpr static size_t NUM_BINS = Config::NUM_BINS; // last bin takes everything above the largest range
+    constexpr static size_t BIN_MAP_WORDS = NUM_BINS/64;
+    static_assert(sizeof(TreeLinks) <= SMALL_BIN_LIMIT && SMALL_BIN_LIMIT_LOG2 < 32);
+    static_assert(std::has_single_bit(LARGE_BINS_PER_POW2) && (SMALL_BIN_LIMIT >> LARGE_BINS_LOG2) >= SIZE_GRANULE);
+    // large bins come in whole powers of two and fill whole words of the bin map
+    static_assert(NUM_BINS > NUM_SMALL_BINS && (NUM_BINS-NUM_SMALL_BINS) % LARGE_BINS_PER_POW2 == 0 && NUM_BINS % 64 == 0);
+
+    // getBinIndex() by the bit width of the size: bin = base + ((size >> shift) & mask), with no compare on the way
+    struct BinRow
+    {
+        size_t base;
+        size_t shift;
+        size_t mask;
+    };
+    constexpr static std::array<BinRow, 65> BIN_ROWS = []
+    {
+        std::array<BinRow, 65> rows{};
+        for (size_t width = 0; width < rows.size(); ++width)
+        {
+            size_t base = NUM_SMALL_BINS + (width-1-SMALL_BIN_LIMIT_LOG2)*LARGE_BINS_PER_POW2;
+            if (width <= SMALL_BIN_LIMIT_LOG2) rows[width] = {0, std::countr_zero(SIZE_GRANULE), ~size_t{0}};
+            else if (base+LARGE_BINS_PER_POW2 > NUM_BINS) rows[width] = {NUM_BINS-1, 0, 0};
+            else rows[width] = {base, width-1-LARGE_BINS_LOG2, LARGE_BINS_PER_POW2-1};
+        }
+        return rows;
+    }();
+
+    // tiny objects have no header of their own; they are carved from page-sized runs of a single size
+    // class and the run header at the start of the page describes all of them
+    struct HeapArena;
+    struct SlabRun
+    {
+        HeapArena* arena;
+        SlabRun* nextRun; // runs of the same class that still have free objects
+        SlabRun* prevRun;
+        void* freeList; // embedded free list through the freed objects
+        char* bumpNext; // objects from here on were never handed out
+        uint32_t objectSize;
+        uint32_t freeCount;
+        uint32_t capacity;
+    };
+
+    // deferred blks up to this size wait unmerged in exact-size LIFO bins of their arena
+    constexpr static size_t FAST_BIN_MAX_SIZE = 1024;
+    constexpr static size_t NUM_FAST_BINS = FAST_BIN_MAX_SIZE/SIZE_GRANULE;
+
+    // queued frees at which a freeing thread merges them itself when the owner arena's lock is free
+    constexpr static std::ptrdiff_t REMOTE_DRAIN_THRESHOLD = 256;
+
+    constexpr static size_t MAX_NUMA_NODES = 64; // what one word of mbind's node mask covers
+
+    constexpr static size_t SLAB_MAX_SIZE = 256;
+    constexpr static size_t NUM_SLAB_CLASSES = SLAB_MAX_SIZE/SIZE_GRANULE;
+    constexpr static size_t SLAB_RUN_SIZE = 4096;
+    constexpr static size_t SLAB_RUN_HEADER_SIZE = (sizeof(SlabRun)+15) & ~size_t{15};
+    constexpr static size_t SLAB_REGION_SIZE = 4ULL*1024*1024*1024; // 4GB of address space, committed on demand
+    constexpr static size_t SLAB_COMMIT_SIZE = 1024*1024;
+
+    // the lock behind every guard but the trace's, whose flusher is a thread of its own whatever the policy
+    struct NoLock
+    {
+        void lock() {}
+        bool try_lock() { return true; }
+        void unlock() {}
+    };
+    class SpinLock
+    {
+    public:
+        void lock()
+        {
+            while (locked.exchange(true, std::memory_order_acquire))
+            {
+                for (unsigned spins = 0; locked.load(std::memory_order_relaxed); ++spins)
+                {
+                    if (spins >= 64) sched_yield();
+                }
+            }
+        }
+
+        bool try_lock() { return !locked.load(std::memory_order_relaxed) && !locked.exchange(true, std::memory_order_acquire); }
+
+        void unlock() { locked.store(false, std::memory_order_release); }
+
+    private:
+        std::atomic<bool> locked{false};
+    };
+    using LockPolicy = typename Config::LockPolicy;
+    using Mutex = std::conditional_t<std::is_same_v<LockPolicy, Locking::None>, NoLock,
+                  std::conditional_t<std::is_same_v<LockPolicy, Locking::Spin>, SpinLock, std::mutex>>;
+    static_assert(std::is_same_v<LockPolicy, Locking::None> || std::is_same_v<LockPolicy, Locking::Spin>
+                  || std::is_same_v<LockPolicy, Locking::Mutex>);
+
+    // an independent heap with its own lock; arena 0 grows the sbrk break, the others map chunks
+    struct HeapArena
+    {
+        Mutex mutex; // guards everything below
+        MemoryBlock* freeBins[NUM_BINS] = {}; // only free blocks, one list (or trie root) per size class
+        uint64_t binMap[BIN_MAP_WORDS] = {}; // bit set when the matching bin is non-empty
+        char* heapEnd = nullptr; // end of the sbrk segment last grown, main arena only
+        // last blk before the fencepost of the newest segment or chunk, flagged free but never binned
+        MemoryBlock* top = nullptr;
+        char* topCleanFrom = nullptr; // top memory from here on was never written
+        SlabRun* partialRuns[NUM_SLAB_CLASSES] = {}; // runs with at least one free object
+        MemoryBlock* rover = nullptr; // next-fit resume point, a binned blk or nullptr
+        // freed but unmerged blks, still flagged in use and linked through their first payload word
+        MemoryBlock* fastBins[NUM_FAST_BINS] = {};
+        size_t fastBinBytes = 0;
+        // frees from threads of other arenas, pushed without the lock and linked through the first payload word
+        std::atomic<void*> remoteFrees{nullptr};
+        std::atomic<std::ptrdiff_t> remoteFreeCount{0}; // roughly how many are queued, drops behind the exchange
+        bool isMainArena = false;
+        int node = -1; // NUMA node new chunks are bound to, -1 unless arenas are selected per node
+        uint64_t splits = 0; // heap blks split in two, tails trimmed off included
+        uint64_t merges = 0; // heap blks merged with a free neighbour
+        size_t slabBytesInUse = 0; // slab objects handed out, thread cached ones included
+    };
+
+    // non-main arenas grow in chunks aligned to their size, so a blk finds its chunk by masking its address
+    struct ArenaChunk
+    {
+        HeapArena* arena;
+    };
+
+    constexpr static size_t DEFAULT_HEAP_GROWTH = Config::DEFAULT_HEAP_GROWTH;
+    constexpr static size_t DEFAULT_TRIM_THRESHOLD = Config::DEFAULT_TRIM_THRESHOLD;
+
+    constexpr static size_t MAX_ARENAS = 64;
+    constexpr static size_t HUGE_PAGE_SIZE = 2*1024*1024; // 2MB
+    constexpr static size_t DEFAULT_HUGE_PAGE_SLACK = 256*1024; // 256KB
+    constexpr static size_t ARENA_CHUNK_SIZE = HUGE_PAGE_SIZE; // one huge page when those are enabled
+    constexpr static size_t ARENA_CHUNK_HEADER_SIZE = (sizeof(ArenaChunk)+SIZE_GRANULE-1) & ~(SIZE_GRANULE-1);
+    constexpr static size_t ARENA_CHUNK_CAPACITY = ARENA_CHUNK_SIZE - ARENA_CHUNK_HEADER_SIZE - 2*sizeof(MemoryBlock);
+    // aligned requests ask the heap for up to one extra MIN_USEABLE_SIZE lead on top of the threshold
+    static_assert(MMAP_THRESHOLD_MAX+MIN_USEABLE_SIZE <= ARENA_CHUNK_CAPACITY);
+    static_assert(SMALL_BIN_LIMIT <= DEFAULT_MMAP_THRESHOLD && DEFAULT_MMAP_THRESHOLD <= MMAP_THRESHOLD_MAX);
+
+    // a chunk of a region, ARENA_CHUNK_SIZE unless one request needed more; the bump space follows the header
+    struct RegionChunk
+    {
+        RegionChunk* next; // in the order the region walks them, which mapping keeps after the current one
+        size_t length;
+
+        char* begin() { return reinterpret_cast<char*>(this+1); }
+        char* end() { return reinterpret_cast<char*>(this)+length; }
+    };
+
+public:
+    enum class ArenaSelection
+    {
+        RoundRobin, // each thread sticks to the arena it was handed on first use
+        PerCpu, // the arena of the cpu the thread is currently running on
+        // arenas are dealt out to the NUMA nodes and bind their chunks to theirs, threads take one of the
+        // arenas of the node they are running on
+        PerNode,
+    };
+
+    // backing for arena chunks and for large blks that waste no more than the slack when rounded to huge pages
+    enum class HugePages
+    {
+        Off,
+        Transparent, // HUGE_PAGE_SIZE aligned mappings advised with MADV_HUGEPAGE
+        HugeTlb, // MAP_HUGETLB from the reserved pool, Transparent once that runs dry
+    };
+
+    // a snapshot taken by getStats(); arenas are visited one at a time, so under load the totals may be
+    // slightly out of step with each other; without Config::STATS the call, split/merge and syscall counts stay 0
+    struct Stats
+    {
+        // counted per thread; realloc counts as a malloc and a free only when it moves the blk
+        uint64_t mallocCalls = 0; // malloc, calloc and the aligned variants
+        uint64_t freeCalls = 0;
+
+        size_t bytesInUse = 0; // handed out and not freed yet: thread cached blks and heap headers included
+        size_t sbrkBytes = 0; // main arena heap
+        size_t chunkBytes = 0; // chunks of the other arenas
+        size_t slabBytes = 0; // committed part of the slab region, released runs left out
+        size_t regionBytes = 0; // chunks of live Arena regions, counted as in use
+        size_t mmapBytes = 0; // mappings of live large blks
+        size_t mmapBlocks = 0;
+        size_t cachedMappingBytes = 0; // freed mappings kept for reuse
+        size_t peakBytes = 0; // most that sbrk, chunk, slab, region and mapped bytes (cached ones included) ever added up to
+
+        size_t freeBytes = 0; // payloads of binned blks, fast bins and tops
+        size_t freeBlocks = 0;
+        size_t topBytes = 0;
+        size_t fastBinBytes = 0;
+        size_t fastBinBlocks = 0;
+        size_t binLengths[NUM_BINS] = {}; // free blks per size class, summed over the arenas
+        uint64_t splits = 0;
+        uint64_t merges = 0;
+
+        uint64_t sbrkCalls = 0;
+        uint64_t mmapCalls = 0;
+        uint64_t munmapCalls = 0;
+        uint64_t mremapCalls = 0;
+        uint64_t madviseCalls = 0;
+        uint64_t mprotectCalls = 0;
+        uint64_t mbindCalls = 0;
+    };
+
+    // one live sampled allocation, as passed to forEachHeapSample()
+    struct HeapSample
+    {
+        const void* ptr;
+        size_t size;
+        uint64_t timestampNanos; // wall clock when it was allocated
+        size_t depth;
+        void* const* stack; // return addresses, innermost first
+    };
+
+    constexpr static size_t DEFAULT_PROFILE_SAMPLE_RATE = 512*1024; // 512KB
+
+    // the fields of glibc's struct mallinfo2, filled from getStats()
+    struct MallInfo
+    {
+        size_t arena; // non-mmapped space: heap, chunks, slab region and regions
+        size_t ordblks; // free blks, tops included
+        size_t smblks; // free blks in fast bins
+        size_t hblks; // mmapped blks
+        size_t hblkhd; // bytes in mmapped blks
+        size_t usmblks; // peak footprint
+        size_t fsmblks; // bytes in fast bins
+        size_t uordblks; // bytes in use outside mmapped blks
+        size_t fordblks; // free bytes
+        size_t keepcost; // top of the main arena, the most malloc_trim() could release from the break
+    };
+
+    // a region from createArena(): allocating bumps a pointer through chunks mapped like those of the heap
+    // arenas, and nothing is freed on its own; reset() rewinds over the chunks it has without a syscall and
+    // destroy(), or the destructor, unmaps them. Not thread-safe, a region belongs to one request or thread
+    class Arena
+    {
+    public:
+        Arena(Arena&& other) noexcept
+            : owner(other.owner), chunks(std::exchange(other.chunks, nullptr)), current(std::exchange(other.current, nullptr)),
+              bumpNext(std::exchange(other.bumpNext, nullptr)), bumpEnd(std::exchange(other.bumpEnd, nullptr)) {}
+
+        Arena& operator=(Arena&& other) noexcept
+        {
+            if (this == &other) return *this;
+            destroy();
+            owner = other.owner;
+            chunks = std::exchange(other.chunks, nullptr);
+            current = std::exchange(other.current, nullptr);
+            bumpNext = std::exchange(other.bumpNext, nullptr);
+            bumpEnd = std::exchange(other.bumpEnd, nullptr);
+            return *this;
+        }
+
+        ~Arena() { destroy(); }
+
+        // alignment must be a power of two; nullptr once no chunk can be mapped
+        void* alloc(size_t size, size_t alignment = alignof(std::max_align_t))
+        {
+            for (;;)
+            {
+                if (current)
+                {
+                    char* ptr = alignUp(bumpNext, alignment);
+                    if (ptr <= bumpEnd && size <= static_cast<size_t>(bumpEnd-ptr))
+                    {
+                        bumpNext = ptr+size;
+                        return ptr;
+                    }
+                }
+                if (!nextChunk(size, alignment)) return nullptr;
+            }
+        }
+
+        // every allocation is gone, the chunks are reused from the first one on
+        void reset()
+        {
+            current = chunks;
+            bumpNext = chunks ? chunks->begin() : nullptr;
+            bumpEnd = chunks ? chunks->end() : nullptr;
+        }
+
+        void destroy()
+        {
+            while (RegionChunk* chunk = chunks)
+            {
+                chunks = chunk->next;
+                owner->unmapRegionChunk(chunk);
+            }
+            current = nullptr;
+            bumpNext = bumpEnd = nullptr;
+        }
+
+    private:
+        friend class SbrkMemoryAllocator;
+        explicit Arena(SbrkMemoryAllocator& owner) : owner(&owner) {}
+
+        // the next kept chunk the request fits, or a new one mapped right behind the current chunk
+        bool nextChunk(size_t size, size_t alignment)
+        {
+            RegionChunk** link = current ? &current->next : &chunks;
+            RegionChunk* chunk = *link;
+            while (chunk && !fits(chunk, size, alignment)) chunk = chunk->next;
+            if (!chunk)
+            {
+                if (!(chunk = owner->mapRegionChunk(size, alignment))) return false;
+                chunk->next = *link;
+                *link = chunk;
+            }
+            current = chunk;
+            bumpNext = chunk->begin();
+            bumpEnd = chunk->end();
+            return true;
+        }
+
+        static bool fits(RegionChunk* chunk, size_t size, size_t alignment)
+        {
+            auto lead = static_cast<size_t>(alignUp(chunk->begin(), alignment) - chunk->begin());
+            size_t capacity = static_cast<size_t>(chunk->end()-chunk->begin());
+            return lead <= capacity && size <= capacity-lead;
+        }
+
+        SbrkMemoryAllocator* owner;
+        RegionChunk* chunks = nullptr;
+        RegionChunk* current = nullptr; // nullptr before the first allocation and after a reset of an empty region
+        char* bumpNext = nullptr;
+        char* bumpEnd = nullptr;
+    };
+
+    // std::pmr adapter for a region: containers allocate from it and deallocating is a no-op, the memory
+    // comes back with the region's reset()
+    class ArenaResource : public std::pmr::memory_resource
+    {
+    public:
+        explicit ArenaResource(Arena& arena) : arena(arena) {}
+
+    private:
+        Arena& arena;
+
+        void* do_allocate(size_t bytes, size_t alignment) override
+        {
+            void* ptr = arena.alloc(bytes, alignment);
+            if (!ptr) throw std::bad_alloc();
+            return ptr;
+        }
+
+        void do_deallocate(void*, size_t, size_t) override {}
+
+        bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+        {
+            return this == &other;
+        }
+    };
+
+private:
+    HeapArena arenas[MAX_ARENAS];
+    size_t numArenas;
+    std::atomic<size_t> nextArena{0};
+    std::atomic<ArenaSelection> arenaSelection{ArenaSelection::RoundRobin};
+    std::atomic<size_t> numaNodes{1}; // nodes the arenas are dealt out to, never more than the arenas
+    std::atomic<uint8_t> numaNodeIndex[MAX_NUMA_NODES] = {}; // node id to its place among the online nodes
+    std::atomic<size_t> heapGrowthSize{DEFAULT_HEAP_GROWTH};
+    std::atomic<size_t> trimThreshold{DEFAULT_TRIM_THRESHOLD};
+    std::atomic<size_t> mmapThreshold{DEFAULT_MMAP_THRESHOLD};
+    std::atomic<bool> dynamicThresholds{true}; // cleared once either threshold is set by hand
+    std::atomic<HugePages> hugePages{HugePages::Off};
+    std::atomic<size_t> hugePageSlack{DEFAULT_HUGE_PAGE_SLACK};
+    std::atomic<size_t> fastBinLimit{0};
+
+    // released mappings keyed by the bin size classes; expired or over-budget ones are unmapped oldest first
+    Mutex mappingCacheMutex; // guards the fields below
+    CachedMapping* cachedMappings[NUM_BINS] = {};
+    CachedMapping* newestMapping = nullptr;
+    CachedMapping* oldestMapping = nullptr;
+    size_t cachedMappingBytes = 0;
+    std::atomic<size_t> mappingCacheLimit{DEFAULT_MAPPING_CACHE_LIMIT};
+    std::atomic<std::chrono::milliseconds> mappingCacheDecay{DEFAULT_MAPPING_CACHE_DECAY};
+
+    // where the main arena's segments lie, so a blk can tell the sbrk heap from a chunk without its header;
+    // written under the main arena's lock
+    std::atomic<char*> mainHeapStart{nullptr};
+    std::atomic<char*> mainHeapEnd{nullptr};
+
+    // every run lives in one reserved region, so telling a slab pointer from a blk is a range check
+    std::atomic<char*> slabRegionBase{nullptr};
+    Mutex slabRegionMutex; // guards the fields below
+    char* slabRegionTop = nullptr; // next run never handed out
+    char* slabRegionCommitted = nullptr; // end of the read/write part of the region
+    uint32_t* unusedRuns = nullptr; // indices of released runs, kept apart so their pages stay unbacked
+    size_t numUnusedRuns = 0;
+    bool slabRegionFailed = false;
+    std::atomic<size_t> slabLimit{SLAB_MAX_SIZE};
+
+    // thread caches cover the small bins; a limit of 0 disables caching for that size
+    constexpr static size_t TCACHE_MAX_SIZE = SMALL_BIN_LIMIT;
+    constexpr static size_t NUM_TCACHE_BINS = NUM_SMALL_BINS;
+    constexpr static uint32_t TCACHE_DEFAULT_LIMIT = Config::TCACHE_DEFAULT_LIMIT;
+
+    uint32_t tcacheLimits[NUM_TCACHE_BINS];
+
+    // recently freed small payloads of one thread (heap blks or slab objects), they stay marked in use so
+    // the heap never merges them
+    struct ThreadCache
+    {
+        SbrkMemoryAllocator* owner = nullptr;
+        HeapArena* arena = nullptr; // round-robin assignment
+        void* bins[NUM_TCACHE_BINS] = {}; // linked through the first word of each payload
+        uint32_t counts[NUM_TCACHE_BINS] = {};
+        ThreadCache* nextCache = nullptr; // registry of the owner, guarded by its statsMutex
+        ThreadCache* prevCache = nullptr;
+        // only this thread writes them, the stats read them from any thread
+        std::atomic<uint64_t> mallocCalls{0};
+        std::atomic<uint64_t> freeCalls{0};
+        std::ptrdiff_t bytesUntilSample = 0; // profiler countdown, the thread's first trip only seeds it
+        uint64_t sampleSeed = 0;
+        TraceRing* traceRing = nullptr;
+        bool traceExempt = false; // the flusher, and threads past their cache's destruction
+        // destroyed; pthread key destructors run after thread_local ones, their frees go straight to the arena
+        bool retired = false;
+
+        ~ThreadCache()
+        {
+            if (!owner) return;
+            if (traceRing) traceRing->abandoned.store(true, std::memory_order_release);
+            traceExempt = true;
+            // set ahead of the calls, a store after them would be dead to the compiler
+            retired = true;
+            owner->flushCache(*this);
+            owner->retireThreadCache(*this);
+        }
+    };
+    static thread_local ThreadCache threadCache;
+
+    // every live thread cache, so the per-thread call counts can be summed on demand
+    Mutex statsMutex; // guards the fields below
+    ThreadCache* threadCaches = nullptr;
+    uint64_t retiredMallocCalls = 0; // folded in from exited threads
+    uint64_t retiredFreeCalls = 0;
+    // calls from threads that cache for another allocator
+    std::atomic<uint64_t> uncachedMallocCalls{0};
+    std::atomic<uint64_t> uncachedFreeCalls{0};
+
+    // process footprint and syscall counts, updated next to each call
+    struct SystemCounters
+    {
+        std::atomic<size_t> sbrkBytes{0}; // what the break was moved by
+        std::atomic<size_t> chunkBytes{0}; // arena chunks
+        std::atomic<size_t> mappedBytes{0}; // mappings of large blks, cached ones included
+        std::atomic<size_t> mmapBlocks{0}; // live large blks
+        std::atomic<size_t> slabBytes{0}; // committed part of the slab region, released runs left out
+        std::atomic<size_t> regionBytes{0}; // chunks of Arena regions
+        std::atomic<size_t> peakBytes{0}; // high watermark of footprint()
+        std::atomic<uint64_t> sbrkCalls{0};
+        std::atomic<uint64_t> mmapCalls{0};
+        std::atomic<uint64_t> munmapCalls{0};
+        std::atomic<uint64_t> mremapCalls{0};
+        std::atomic<uint64_t> madviseCalls{0};
+        std::atomic<uint64_t> mprotectCalls{0};
+        std::atomic<uint64_t> mbindCalls{0};
+
+        size_t footprint() const
+        {
+            return sbrkBytes.load(std::memory_order_relaxed) + chunkBytes.load(std::memory_order_relaxed)
+                 + mappedBytes.load(std::memory_order_relaxed) + slabBytes.load(std::memory_order_relaxed)
+                 + regionBytes.load(std::memory_order_relaxed);
+        }
+    };
+    SystemCounters counters;
+
+    // heap profiler; sampled blks are mmap'd one by one, like the dedicated spans of tcmalloc's sampled objects,
+    // so free() only has to look for them on its mmap path
+    std::atomic<size_t> profileSampleRate{0};
+    std::atomic<bool> hasSampledBlocks{false}; // set for good by the first sample
+    Mutex profileMutex; // guards the fields below
+    SampleRecord* liveSamples = nullptr;
+    size_t liveSampleCount = 0;
+    size_t liveSampleBytes = 0;
+    size_t profiledRate = 0; // rate the latest sample was taken at
+
+    // allocation trace; records are only appended while tracing is set, the flusher owns traceFd until it is joined
+    std::atomic<bool> tracing{false};
+    int traceFd = -1;
+    pthread_t traceFlusher;
+    std::mutex traceMutex; // guards the fields below
+    TraceRing* traceRings = nullptr;
+    uint32_t nextTraceThreadId = 0;
+
+public:
+    // arenaCount of 0 picks one arena per hardware thread
+    explicit SbrkMemoryAllocator(size_t arenaCount = 0)
+    {
+        if (!arenaCount) arenaCount = std::thread::hardware_concurrency();
+        numArenas = std::clamp<size_t>(arenaCount, 1, MAX_ARENAS);
+        arenas[0].isMainArena = true;
+        std::fill(std::begin(tcacheLimits), std::end(tcacheLimits), TCACHE_DEFAULT_LIMIT);
+    }
+
+    // the heap itself is never released, this only flushes and detaches the calling thread's cache; the
+    // flush also has GCC instantiate ~ThreadCache for programs that never reach the thread cache otherwise
+    ~SbrkMemoryAllocator()
+    {
+        stopTrace();
+        if (threadCache.owner != this || threadCache.retired) return;
+        flushThreadCache();
+        retireThreadCache(threadCache);
+        threadCache.owner = nullptr;
+        threadCache.arena = nullptr;
+        std::fill(std::begin(threadCache.bins), std::end(threadCache.bins), nullptr);
+        std::fill(std::begin(threadCache.counts), std::end(threadCache.counts), 0);
+    }
+
+    SbrkMemoryAllocator(const SbrkMemoryAllocator&) = delete;
+    SbrkMemoryAllocator& operator=(const SbrkMemoryAllocator&) = delete;
+
+    void* malloc(size_t size)
+    {
+        size_t dirtyBytes;
+        void* ptr = allocate(addCanaryRoom(size), dirtyBytes);
+        if (ptr) writeCanary(ptr, size);
+        if (ptr && tracing.load(std::memory_order_relaxed)) recordTrace(TraceOp::Malloc, ptr, nullptr, size, traceClock());
+        return ptr;
+    }
+
+    // only recycled memory is cleared; fresh mmap, chunk, slab and sbrk memory is already zero
+    void* calloc(size_t count, size_t size)
+    {
+        size_t totalSize;
+        if (__builtin_mul_overflow(count, size, &totalSize))
+        {
+            errno = ENOMEM;
+            return nullptr;
+        }
+
+        size_t dirtyBytes;
+        void* ptr = allocate(addCanaryRoom(totalSize), dirtyBytes);
+        if (ptr) memset(ptr, 0, std::min(dirtyBytes, totalSize));
+        if (ptr) writeCanary(ptr, totalSize);
+        if (ptr && tracing.load(std::memory_order_relaxed)) recordTrace(TraceOp::Calloc, ptr, nullptr, totalSize, traceClock());
+        return ptr;
+    }
+
+    void free(void* ptr)
+    {
+        if (!ptr) return;
+        if constexpr (CANARIES) checkCanary(ptr);
+        traceFree(ptr);
+        release(ptr);
+    }
+
+    // alignment must be a power of two; the heap path splits the lead off as a free blk instead of wasting it
+    void* aligned_alloc(size_t alignment, size_t size)
+    {
+        void* ptr = allocateAligned(alignment, addCanaryRoom(size));
+        if (ptr) writeCanary(ptr, size);
+        if (ptr && tracing.load(std::memory_order_relaxed)) recordTrace(TraceOp::AlignedAlloc, ptr, nullptr, size, traceClock(), alignment);
+        return ptr;
+    }
+
+    void* memalign(size_t alignment, size_t size)
+    {
+        return aligned_alloc(alignment, size);
+    }
+
+    int posix_memalign(void** memptr, size_t alignment, size_t size)
+    {
+        if (!std::has_single_bit(alignment) || alignment%sizeof(void*) != 0) return EINVAL;
+        void* ptr = aligned_alloc(alignment, size);
+        if (!ptr) return ENOMEM;
+        *memptr = ptr;
+        return 0;
+    }
+
+    // resizes in place whenever possible: shrinking splits, growing absorbs a free successor or moves the
+    // break when the blk ends the sbrk heap, and large blks are moved by the kernel with mremap
+    void* realloc(void* ptr, size_t size)
+    {
+        if (CANARIES && ptr) checkCanary(ptr);
+        // stamped before a moved blk is freed, another thread may get the address back and record it right away
+        bool traced = tracing.load(std::memory_order_relaxed);
+        uint64_t timestamp = traced ? traceClock() : 0;
+        void* newPtr = reallocate(ptr, size && CANARIES ? addCanaryRoom(size) : size);
+        if (newPtr) writeCanary(newPtr, size);
+        if (traced && (newPtr || !size)) recordTrace(TraceOp::Realloc, newPtr, ptr, size, timestamp);
+        return newPtr;
+    }
+
+    // C23 free_sized, `size` being what the blk was requested with; small blks are only mmap'd when sampled, so with
+    // no samples taken they go to this thread's cache without their header being read. The owner is found by
+    // address, and a blk of another arena is queued to it like release() does
+    void free_sized(void* ptr, size_t size)
+    {
+        if (!ptr) return;
+        if constexpr (CANARIES) checkCanary(ptr);
+        traceFree(ptr);
+        size_t blockSize = alignSize(std::max(addCanaryRoom(size), MIN_PAYLOAD_SIZE));
+        checkFreedSize(ptr, blockSize);
+        ThreadCache* cache = getThreadCache();
+        // hardened builds always read the header, release() checks it
+        if (!HARDENED && !hasSampledBlocks.load(std::memory_order_relaxed) && cache && blockSize < TCACHE_MAX_SIZE && tcacheLimits[blockSize/SIZE_GRANULE])
+        {
+            countFree(cache);
+            if (numArenas > 1)
+            {
+                HeapArena& arena = findUnmappedOwner(ptr);
+                if (&arena != &selectArena(cache))
+                {
+                    pushRemoteFrees(arena, ptr, ptr, 1);
+                    return;
+                }
+            }
+            // the blk may be a little larger than its bin, which only matters once it is flushed
+            addToThreadCache(*cache, blockSize/SIZE_GRANULE, ptr);
+            return;
+        }
+        release(ptr);
+    }
+
+    // over-aligned blks may have been mmap'd whatever their size, only the header can tell
+    void free_aligned_sized(void* ptr, size_t alignment, size_t size)
+    {
+        if (alignment <= SIZE_GRANULE) return free_sized(ptr, size);
+        if (!ptr) return;
+        if constexpr (CANARIES) checkCanary(ptr);
+        traceFree(ptr);
+        checkFreedSize(ptr, alignSize(addCanaryRoom(size)));
+        release(ptr);
+    }
+    // `count` blks of `size` bytes into `out`, returns how many there are, fewer only when memory ran out; the thread's
+    // cache goes first, the rest is taken under a single arena lock from slab runs or carved from one heap blk
+    size_t mallocBatch(size_t size, size_t count, void** out)
+    {
+        if (!count || !checkRequestSize(size)) return 0;
+        size_t blockSize = alignSize(std::max(addCanaryRoom(size), MIN_PAYLOAD_SIZE));
+        ThreadCache* cache = getThreadCache();
+        // mapped blks and a sample falling due within the batch are left to the one-by-one path
+        size_t totalSize;
+        if (blockSize >= mmapThreshold.load(std::memory_order_relaxed) || __builtin_mul_overflow(blockSize, count, &totalSize)
+            || (cache && cache->bytesUntilSample < static_cast<std::ptrdiff_t>(std::min<size_t>(totalSize, PTRDIFF_MAX))))
+        {
+            size_t allocated = 0;
+            while (allocated < count && (out[allocated] = malloc(size))) ++allocated;
+            return allocated;
+        }
+        if (cache) cache->bytesUntilSample -= totalSize;
+
+        size_t allocated = 0;
+        if (cache && blockSize < TCACHE_MAX_SIZE)
+        {
+            while (allocated < count && cache->bins[blockSize/SIZE_GRANULE]) out[allocated++] = popThreadCache(*cache, blockSize/SIZE_GRANULE);
+        }
+        if (allocated < count)
+        {
+            HeapArena& arena = selectArena(cache);
+            std::lock_guard<Mutex> lock(arena.mutex);
+            drainRemoteFrees(arena);
+            allocated += allocateBatchFromArena(arena, blockSize, count-allocated, out+allocated);
+        }
+
+        bool traced = tracing.load(std::memory_order_relaxed);
+        for (size_t i = 0; i < allocated; ++i)
+        {
+            countMalloc(cache);
+            writeCanary(out[i], size);
+            if (traced) recordTrace(TraceOp::Malloc, out[i], nullptr, size, traceClock());
+        }
+        return allocated;
+    }
+
+    // frees every non-null pointer of `ptrs`; whatever the thread's cache has no room for is released under one lock
+    // of this thread's arena, and consecutive blks of another arena are queued to it with a single exchange
+    void freeBatch(void** ptrs, size_t count)
+    {
+        ThreadCache* cache = getThreadCache();
+        HeapArena& home = selectArena(cache);
+        std::unique_lock<Mutex> lock(home.mutex, std::defer_lock);
+        HeapArena* remoteArena = nullptr;
+        void* remoteFirst = nullptr; // chain of frees bound for remoteArena, linked first to last
+        void* remoteLast = nullptr;
+        size_t remoteCount = 0;
+        for (size_t i = 0; i < count; ++i)
+        {
+            void* ptr = ptrs[i];
+            if (!ptr) continue;
+            if constexpr (CANARIES) checkCanary(ptr);
+            traceFree(ptr);
+            countFree(cache);
+            SlabRun* run = findSlabRun(ptr);
+            MemoryBlock* block = run ? nullptr : getBlock(ptr);
+            if (block) checkLiveBlock(block);
+            if (block && block->hasFlag(FLAG_MMAPPED))
+            {
+                releaseMapped(reinterpret_cast<MmapBlock*>(block));
+                continue;
+            }
+
+            HeapArena& arena = run ? *run->arena : getArena(block);
+            if (&arena != &home)
+            {
+                if (&arena != remoteArena)
+                {
+                    if (remoteFirst) pushRemoteFrees(*remoteArena, remoteFirst, remoteLast, remoteCount);
+                    remoteArena = &arena;
+                    remoteFirst = nullptr;
+                    remoteCount = 0;
+                }
+                if (remoteFirst) storeLink(remoteLast, ptr);
+                else remoteFirst = ptr;
+                remoteLast = ptr;
+                ++remoteCount;
+                continue;
+            }
+
+            // only while the bin has room, flushing it would take arena locks with home's held
+            size_t size = run ? run->objectSize : block->size();
+            if (cache && size < TCACHE_MAX_SIZE && cache->counts[size/SIZE_GRANULE] < tcacheLimits[size/SIZE_GRANULE])
+            {
+                addToThreadCache(*cache, size/SIZE_GRANULE, ptr);
+                continue;
+            }
+            if (!lock.owns_lock()) lock.lock();
+            releaseToArena(home, ptr);
+        }
+        if (remoteFirst) pushRemoteFrees(*remoteArena, remoteFirst, remoteLast, remoteCount);
+    }
+
+    // with canaries, exactly the size that was asked for
+    size_t malloc_usable_size(void* ptr) const
+    {
+        if (!ptr) return 0;
+        if constexpr (CANARIES) return checkCanary(ptr);
+        return blockUsableSize(ptr);
+    }
+
+    // minimum step the sbrk heap grows by, the break always ends on a page boundary
+    void setHeapGrowthSize(size_t size)
+    {
+        heapGrowthSize.store(size, std::memory_order_relaxed);
+    }
+
+    // once the sbrk top exceeds this after a free, the break is lowered back to one growth step; 0 disables
+    void setTrimThreshold(size_t size)
+    {
+        trimThreshold.store(size, std::memory_order_relaxed);
+        dynamicThresholds.store(false, std::memory_order_relaxed);
+    }
+
+    // requests of this size and up get their own mapping, kept between TCACHE_MAX_SIZE and MMAP_THRESHOLD_MAX;
+    // freeing a mapped blk raises it to just past that blk's size until this or setTrimThreshold() is called
+    void setMmapThreshold(size_t size)
+    {
+        mmapThreshold.store(std::clamp(size, TCACHE_MAX_SIZE, MMAP_THRESHOLD_MAX), std::memory_order_relaxed);
+        dynamicThresholds.store(false, std::memory_order_relaxed);
+    }
+
+    // give free memory back to the OS: every top keeps `pad` bytes, the sbrk break is lowered, fully free
+    // arena chunks are unmapped and the whole pages inside large free blks are dropped; 1 if anything was released
+    int malloc_trim(size_t pad)
+    {
+        bool released = false;
+        for (size_t i = 0; i < numArenas; ++i)
+        {
+            std::lock_guard<Mutex> lock(arenas[i].mutex);
+            released |= trimArena(arenas[i], pad);
+        }
+        released |= evictCachedMappings(SIZE_MAX);
+        return released ? 1 : 0;
+    }
+
+    // defer merging of freed heap blks below FAST_BIN_MAX_SIZE until an arena holds more than `bytes` of them
+    // or a request would have to grow the heap; 0 (the default) merges on every free
+    void setFastBinLimit(size_t bytes)
+    {
+        fastBinLimit.store(bytes, std::memory_order_relaxed);
+        if (bytes) return;
+        for (size_t i = 0; i < numArenas; ++i)
+        {
+            std::lock_guard<Mutex> lock(arenas[i].mutex);
+            consolidateFastBins(arenas[i]);
+        }
+    }
+
+    // only affects chunks and blks mapped from now on
+    void setHugePages(HugePages mode)
+    {
+        hugePages.store(mode, std::memory_order_relaxed);
+    }
+
+    // most a large blk may be rounded up by to fill whole huge pages, beyond that it keeps normal pages
+    void setHugePageSlack(size_t bytes)
+    {
+        hugePageSlack.store(bytes, std::memory_order_relaxed);
+    }
+
+    // bytes of freed mappings kept around for reuse by later large requests; 0 disables the cache
+    void setMappingCacheLimit(size_t bytes)
+    {
+        mappingCacheLimit.store(bytes, std::memory_order_relaxed);
+        evictCachedMappings(0);
+    }
+
+    // how long a cached mapping may sit unused; decay is lazy, expiry is checked whenever the cache is used
+    // and whenever a heap grows, and malloc_trim() empties the cache outright
+    void setMappingCacheDecay(std::chrono::milliseconds decay)
+    {
+        mappingCacheDecay.store(decay, std::memory_order_relaxed);
+    }
+
+    // PerNode reads the online nodes from sysfs; with one node, or one arena, it picks arenas like PerCpu
+    void setArenaSelection(ArenaSelection selection)
+    {
+        int nodeIds[MAX_NUMA_NODES];
+        size_t online = selection == ArenaSelection::PerNode ? readOnlineNumaNodes(nodeIds) : 0;
+        size_t nodes = std::max<size_t>(std::min(online, numArenas), 1);
+        for (auto& index : numaNodeIndex) index.store(0, std::memory_order_relaxed);
+        for (size_t i = 0; i < online; ++i) numaNodeIndex[nodeIds[i]].store(static_cast<uint8_t>(i), std::memory_order_relaxed);
+        for (size_t i = 0; i < numArenas; ++i)
+        {
+            std::lock_guard<Mutex> lock(arenas[i].mutex);
+            arenas[i].node = nodes > 1 ? nodeIds[i % nodes] : -1;
+        }
+        numaNodes.store(nodes, std::memory_order_relaxed);
+        arenaSelection.store(selection, std::memory_order_relaxed);
+    }
+
+    // max number of cached blks per thread for payloads of `size` bytes, excess is flushed in batches
+    void setThreadCacheLimit(size_t size, uint32_t limit)
+    {
+        size = alignSize(size);
+        if (size < TCACHE_MAX_SIZE) tcacheLimits[size/SIZE_GRANULE] = limit;
+    }
+
+    // largest request served from slab runs, 0 sends everything to the heap
+    void setSlabLimit(size_t size)
+    {
+        slabLimit.store(std::min(alignSize(size), SLAB_MAX_SIZE), std::memory_order_relaxed);
+    }
+
+    // hand the calling thread's cached blks back to the heap, e.g. before a thread goes idle, and merge the
+    // frees other threads queued for its arena
+    void flushThreadCache()
+    {
+        if (ThreadCache* cache = getThreadCache()) flushCache(*cache);
+    }
+
+    Stats getStats()
+    {
+        Stats stats;
+        {
+            std::lock_guard<Mutex> lock(statsMutex);
+            stats.mallocCalls = retiredMallocCalls + uncachedMallocCalls.load(std::memory_order_relaxed);
+            stats.freeCalls = retiredFreeCalls + uncachedFreeCalls.load(std::memory_order_relaxed);
+            for (ThreadCache* cache = threadCaches; cache; cache = cache->nextCache)
+            {
+                stats.mallocCalls += cache->mallocCalls.load(std::memory_order_relaxed);
+                stats.freeCalls += cache->freeCalls.load(std::memory_order_relaxed);
+            }
+        }
+
+        size_t slabBytesInUse = 0;
+        for (size_t i = 0; i < numArenas; ++i)
+        {
+            HeapArena& arena = arenas[i];
+            std::lock_guard<Mutex> lock(arena.mutex);
+            stats.splits += arena.splits;
+            stats.merges += arena.merges;
+            slabBytesInUse += arena.slabBytesInUse;
+            if (arena.top)
+            {
+                stats.topBytes += arena.top->size();
+                ++stats.freeBlocks;
+            }
+            stats.fastBinBytes += arena.fastBinBytes;
+            for (MemoryBlock* head : arena.fastBins)
+            {
+                for (MemoryBlock* block = head; block; block = loadLink<MemoryBlock>(block+1)) ++stats.fastBinBlocks;
+            }
+            for (size_t idx = findNonEmptyBin(arena, 0); idx < NUM_BINS; idx = findNonEmptyBin(arena, idx+1))
+            {
+                forEachFreeBlock(arena.freeBins[idx], isTreeBin(idx), [&](MemoryBlock* block)
+                {
+                    ++stats.binLengths[idx];
+                    ++stats.freeBlocks;
+                    stats.freeBytes += block->size();
+                });
+            }
+        }
+        stats.freeBytes += stats.topBytes + stats.fastBinBytes;
+        stats.freeBlocks += stats.fastBinBlocks;
+
+        {
+            std::lock_guard<Mutex> lock(mappingCacheMutex);
+            stats.cachedMappingBytes = cachedMappingBytes;
+        }
+        stats.sbrkBytes = counters.sbrkBytes.load(std::memory_order_relaxed);
+        stats.chunkBytes = counters.chunkBytes.load(std::memory_order_relaxed);
+        stats.slabBytes = counters.slabBytes.load(std::memory_order_relaxed);
+        stats.regionBytes = counters.regionBytes.load(std::memory_order_relaxed);
+        // a mapping can be cached between the two reads
+        size_t mappedBytes = counters.mappedBytes.load(std::memory_order_relaxed);
+        stats.mmapBytes = mappedBytes > stats.cachedMappingBytes ? mappedBytes-stats.cachedMappingBytes : 0;
+        stats.mmapBlocks = counters.mmapBlocks.load(std::memory_order_relaxed);
+        stats.peakBytes = counters.peakBytes.load(std::memory_order_relaxed);
+        size_t heapBytes = stats.sbrkBytes+stats.chunkBytes;
+        stats.bytesInUse = (heapBytes > stats.freeBytes ? heapBytes-stats.freeBytes : 0) + slabBytesInUse + stats.regionBytes + stats.mmapBytes;
+
+        stats.sbrkCalls = counters.sbrkCalls.load(std::memory_order_relaxed);
+        stats.mmapCalls = counters.mmapCalls.load(std::memory_order_relaxed);
+        stats.munmapCalls = counters.munmapCalls.load(std::memory_order_relaxed);
+        stats.mremapCalls = counters.mremapCalls.load(std::memory_order_relaxed);
+        stats.madviseCalls = counters.madviseCalls.load(std::memory_order_relaxed);
+        stats.mprotectCalls = counters.mprotectCalls.load(std::memory_order_relaxed);
+        stats.mbindCalls = counters.mbindCalls.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    MallInfo mallinfo2()
+    {
+        Stats stats = getStats();
+        MallInfo info;
+        info.arena = stats.sbrkBytes+stats.chunkBytes+stats.slabBytes+stats.regionBytes;
+        info.ordblks = stats.freeBlocks-stats.fastBinBlocks;
+        info.smblks = stats.fastBinBlocks;
+        info.hblks = stats.mmapBlocks;
+        info.hblkhd = stats.mmapBytes;
+        info.usmblks = stats.peakBytes;
+        info.fsmblks = stats.fastBinBytes;
+        info.uordblks = stats.bytesInUse-stats.mmapBytes;
+        info.fordblks = stats.freeBytes;
+        std::lock_guard<Mutex> lock(arenas[0].mutex);
+        info.keepcost = arenas[0].top ? arenas[0].top->size() : 0;
+        return info;
+    }
+
+    // getStats() as one line of JSON; it is formatted on the stack and written with write(), so dumping
+    // never allocates and is safe from inside an LD_PRELOAD'ed malloc; false if the write failed
+    bool dumpStats(int fd)
+    {
+        char buffer[STATS_BUFFER_SIZE];
+        return writeAll(fd, buffer, formatStats(getStats(), buffer, sizeof(buffer)));
+    }
+
+    bool dumpStats(FILE* file)
+    {
+        char buffer[STATS_BUFFER_SIZE];
+        size_t length = formatStats(getStats(), buffer, sizeof(buffer));
+        return fwrite(buffer, 1, length, file) == length;
+    }
+
+    // sample on average one allocation per `bytes` allocated and record its size, time and stack until it is
+    // freed; 0 (the default) turns sampling off, threads pick up a change within PROFILE_RECHECK_BYTES
+    void setProfileSampleRate(size_t bytes)
+    {
+        profileSampleRate.store(bytes, std::memory_order_relaxed);
+    }
+
+    // runs under the profiler lock, `fn` must not allocate from this allocator
+    template <typename Fn>
+    void forEachHeapSample(Fn&& fn)
+    {
+        std::lock_guard<Mutex> lock(profileMutex);
+        for (SampleRecord* record = liveSamples; record; record = record->next)
+        {
+            fn(HeapSample{reinterpret_cast<MmapBlock*>(record+1)+1, record->size, record->timestampNanos, record->depth, record->stack});
+        }
+    }
+
+    // the live samples in the legacy heap profile format of gperftools, which pprof reads and scales back up
+    // by the rate in the header; never allocates, false if a write failed
+    bool dumpHeapProfile(int fd)
+    {
+        std::lock_guard<Mutex> lock(profileMutex);
+        char line[1024]; // fits a sample with MAX_STACK_DEPTH frames
+        int length = snprintf(line, sizeof(line), "heap profile: %zu: %zu [%zu: %zu] @ heap_v2/%zu\n",
+                              liveSampleCount, liveSampleBytes, liveSampleCount, liveSampleBytes, profiledRate);
+        if (!writeAll(fd, line, static_cast<size_t>(length))) return false;
+        for (SampleRecord* record = liveSamples; record; record = record->next)
+        {
+            length = snprintf(line, sizeof(line), "1: %zu [1: %zu] @", record->size, record->size);
+            for (size_t i = 0; i < record->depth; ++i) length += snprintf(line+length, sizeof(line)-length, " %p", record->stack[i]);
+            line[length++] = '\n';
+            if (!writeAll(fd, line, static_cast<size_t>(length))) return false;
+        }
+
+        // pprof maps the addresses back to binaries through the memory map
+        constexpr char mapsHeader[] = "\nMAPPED_LIBRARIES:\n";
+        if (!writeAll(fd, mapsHeader, sizeof(mapsHeader)-1)) return false;
+        int maps = open("/proc/self/maps", O_RDONLY | O_CLOEXEC);
+        if (maps < 0) return false;
+        bool written = true;
+        ssize_t result;
+        while (written && (result = read(maps, line, sizeof(line))) != 0)
+        {
+            if (result > 0) written = writeAll(fd, line, static_cast<size_t>(result));
+            else if (errno != EINTR) written = false;
+        }
+        close(maps);
+        return written;
+    }
+
+    // record every malloc, calloc, aligned allocation, realloc and free of this allocator to `path`, in the
+    // format of AllocationTrace.h that malloc_bench replays; each thread appends to its own ring, waiting only
+    // when the ring is full, and a background thread writes the rings out; false if tracing is already on or
+    // the file can't be created. Not to be called concurrently with stopTrace()
+    bool startTrace(const char* path)
+    {
+        if (traceFd >= 0) return false;
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return false;
+        AllocationTraceHeader header{};
+        memcpy(header.magic, TRACE_MAGIC, sizeof(header.magic));
+        header.version = TRACE_VERSION;
+        header.recordSize = sizeof(AllocationTraceRecord);
+        if (!writeAll(fd, reinterpret_cast<const char*>(&header), sizeof(header)))
+        {
+            close(fd);
+            return false;
+        }
+
+        {
+            // records that missed the end of an earlier trace
+            std::lock_guard<std::mutex> lock(traceMutex);
+            for (TraceRing* ring = traceRings; ring; ring = ring->next)
+            {
+                ring->tail.store(ring->head.load(std::memory_order_acquire), std::memory_order_release);
+            }
+        }
+        traceFd = fd;
+        tracing.store(true, std::memory_order_release);
+        if (pthread_create(&traceFlusher, nullptr, runTraceFlusher, this) == 0) return true;
+        tracing.store(false, std::memory_order_relaxed);
+        traceFd = -1;
+        close(fd);
+        return false;
+    }
+
+    // writes out what the rings hold and closes the file; a call that races with it may miss the trace
+    void stopTrace()
+    {
+        if (!tracing.exchange(false, std::memory_order_acq_rel)) return;
+        pthread_join(traceFlusher, nullptr);
+        close(traceFd);
+        traceFd = -1;
+    }
+
+    // pthread_atfork hooks: every lock is held across fork() so the child starts from a consistent heap;
+    // caches of the threads that don't survive the fork are lost to the child
+    void lockForFork()
+    {
+        for (size_t i = 0; i < numArenas; ++i) arenas[i].mutex.lock();
+        slabRegionMutex.lock();
+        mappingCacheMutex.lock();
+        statsMutex.lock();
+        profileMutex.lock();
+        traceMutex.lock();
+    }
+
+    void unlockAfterFork()
+    {
+        traceMutex.unlock();
+        profileMutex.unlock();
+        statsMutex.unlock();
+        mappingCacheMutex.unlock();
+        slabRegionMutex.unlock();
+        for (size_t i = numArenas; i-- > 0;) arenas[i].mutex.unlock();
+    }
+
+    Arena createArena()
+    {
+        return Arena(*this);
+    }
+
+    // the trace flusher is not forked along, so the child stops tracing rather than fill its ring and wait
+    void unlockAfterForkInChild()
+    {
+        if (tracing.exchange(false, std::memory_order_relaxed))
+        {
+            close(traceFd);
+            traceFd = -1;
+        }
+        unlockAfterFork();
+    }
+
+private:
+    constexpr static size_t STATS_BUFFER_SIZE = 2048 + NUM_BINS*48; // fits the counters and two entries per bin
+
+    static bool writeAll(int fd, const char* data, size_t length)
+    {
+        for (size_t written = 0; written < length;)
+        {
+            ssize_t result = write(fd, data+written, length-written);
+            if (result < 0 && errno != EINTR) return false;
+            if (result > 0) written += static_cast<size_t>(result);
+        }
+        return true;
+    }
+
+    static size_t formatStats(const Stats& stats, char* buffer, size_t capacity)
+    {
+        size_t length = 0;
+        auto append = [&](const char* format, auto... args)
+        {
+            int result = snprintf(buffer+length, capacity-length, format, args...);
+            if (result > 0) length = std::min(length+static_cast<size_t>(result), capacity-1);
+        };
+
+        const std::pair<const char*, uint64_t> fields[] = {
+            {"mallocCalls", stats.mallocCalls}, {"freeCalls", stats.freeCalls},
+            {"bytesInUse", stats.bytesInUse}, {"sbrkBytes", stats.sbrkBytes}, {"chunkBytes", stats.chunkBytes},
+            {"slabBytes", stats.slabBytes}, {"regionBytes", stats.regionBytes}, {"mmapBytes", stats.mmapBytes}, {"mmapBlocks", stats.mmapBlocks},
+            {"cachedMappingBytes", stats.cachedMappingBytes}, {"peakBytes", stats.peakBytes},
+            {"freeBytes", stats.freeBytes}, {"freeBlocks", stats.freeBlocks}, {"topBytes", stats.topBytes},
+            {"fastBinBytes", stats.fastBinBytes}, {"fastBinBlocks", stats.fastBinBlocks},
+            {"splits", stats.splits}, {"merges", stats.merges},
+            {"sbrkCalls", stats.sbrkCalls}, {"mmapCalls", stats.mmapCalls}, {"munmapCalls", stats.munmapCalls},
+            {"mremapCalls", stats.mremapCalls}, {"madviseCalls", stats.madviseCalls}, {"mprotectCalls", stats.mprotectCalls},
+            {"mbindCalls", stats.mbindCalls},
+        };
+        for (const auto& [name, value] : fields)
+        {
+            append("%s\"%s\":%llu", length ? "," : "{", name, static_cast<unsigned long long>(value));
+        }
+        // smallest payload of each size class next to its count, so the lengths can be read without the class table
+        append(",\"binSizes\":[");
+        for (size_t idx = 0; idx < NUM_BINS; ++idx) append(idx ? ",%zu" : "%zu", getBinMinSize(idx));
+        append("],\"binLengths\":[");
+        for (size_t idx = 0; idx < NUM_BINS; ++idx) append(idx ? ",%zu" : "%zu", stats.binLengths[idx]);
+        append("]}\n");
+        return length;
+    }
+
+    // `dirtyBytes` is how much of the payload's front may hold old data, the rest is known to be zero
+    void* allocate(size_t size, size_t& dirtyBytes)
+    {
+        if (!checkRequestSize(size)) return nullptr;
+        // every payload can hold the free-list links
+        size = alignSize(std::max(size, MIN_PAYLOAD_SIZE));
+        ThreadCache* cache = getThreadCache();
+        countMalloc(cache);
+        if (cache && (cache->bytesUntilSample -= size) < 0)
+        {
+            if (void* ptr = allocateSampled(*cache, SIZE_GRANULE, size, dirtyBytes)) return ptr;
+        }
+        if (size >= mmapThreshold.load(std::memory_order_relaxed)) return mapBlock(SIZE_GRANULE, size, dirtyBytes);
+
+        if (cache && size < TCACHE_MAX_SIZE && cache->bins[size/SIZE_GRANULE])
+        {
+            dirtyBytes = size;
+            return popThreadCache(*cache, size/SIZE_GRANULE);
+        }
+
+        HeapArena& arena = selectArena(cache);
+        std::lock_guard<Mutex> lock(arena.mutex);
+        drainRemoteFrees(arena);
+        void* ptr = allocateFromArena(arena, size, dirtyBytes);
+        if (ptr && cache && size < TCACHE_MAX_SIZE) refillThreadCache(arena, *cache, size);
+        return ptr;
+    }
+
+    // aligned_alloc(), realloc() and free() minus the trace, so a call going through another one is recorded once
+    void* allocateAligned(size_t alignment, size_t size)
+    {
+        if (!std::has_single_bit(alignment)) return nullptr;
+        size_t dirtyBytes;
+        if (alignment <= SIZE_GRANULE) return allocate(size, dirtyBytes);
+        if (!checkRequestSize(size)) return nullptr;
+
+        size = alignSize(std::max(size, MIN_PAYLOAD_SIZE));
+        ThreadCache* cache = getThreadCache();
+        countMalloc(cache);
+        if (cache && (cache->bytesUntilSample -= size) < 0)
+        {
+            if (void* ptr = allocateSampled(*cache, alignment, size, dirtyBytes)) return ptr;
+        }
+        if (size+alignment >= mmapThreshold.load(std::memory_order_relaxed)) return mapBlock(alignment, size, dirtyBytes);
+
+        HeapArena& arena = selectArena(cache);
+        std::lock_guard<Mutex> lock(arena.mutex);
+        drainRemoteFrees(arena);
+        // room to reach an aligned payload while leaving a lead big enough to be a blk of its own
+        MemoryBlock* block = allocateFromHeap(arena, size+alignment+MIN_USEABLE_SIZE, dirtyBytes);
+        if (!block) return nullptr;
+
+        auto payload = reinterpret_cast<std::uintptr_t>(block+1);
+        auto alignedPayload = (payload + alignment-1) & ~(alignment-1);
+        if (alignedPayload != payload)
+        {
+            if (alignedPayload-payload < MIN_USEABLE_SIZE) alignedPayload += alignment;
+            size_t lead = alignedPayload-payload;
+            auto* alignedBlock = initialiseBlock(reinterpret_cast<char*>(alignedPayload)-sizeof(MemoryBlock), block->size()-lead,
+                                                 block->load() & FLAG_NON_MAIN_ARENA);
+            block->setSize(lead-sizeof(MemoryBlock));
+            countEvent(arena.splits);
+            releaseToHeap(arena, block);
+            block = alignedBlock;
+        }
+        trimBlock(arena, block, size);
+        return reinterpret_cast<void*>(block+1);
+    }
+
+    // sizes no object can have, which would also wrap around once aligned
+    static bool checkRequestSize(size_t size)
+    {
+        if (size <= PTRDIFF_MAX) return true;
+        errno = ENOMEM;
+        return false;
+    }
+
+    void* reallocate(void* ptr, size_t size)
+    {
+        size_t dirtyBytes;
+        if (!ptr) return allocate(size, dirtyBytes);
+        if (!size)
+        {
+            release(ptr);
+            return nullptr;
+        }
+        if (!checkRequestSize(size)) return nullptr;
+
+        size_t newSize = alignSize(std::max(size, MIN_PAYLOAD_SIZE));
+        if (SlabRun* run = findSlabRun(ptr))
+        {
+            if (newSize <= run->objectSize) return ptr;
+        }
+        else
+        {
+            MemoryBlock* block = getBlock(ptr);
+            checkLiveBlock(block);
+            if (block->hasFlag(FLAG_MMAPPED))
+            {
+                // hugetlb mappings can't always be remapped, those are moved by copying below, and so are
+                // sampled blks, which keeps their record in the live list
+                if (newSize >= mmapThreshold.load(std::memory_order_relaxed) && !block->hasFlag(FLAG_SAMPLED))
+                {
+                    if (void* newPtr = remapBlock(reinterpret_cast<MmapBlock*>(block), newSize)) return newPtr;
+                }
+            }
+            else
+            {
+                HeapArena& arena = getArena(block);
+                std::lock_guard<Mutex> lock(arena.mutex);
+                if (resizeInPlace(arena, block, newSize)) return ptr;
+            }
+        }
+
+        void* newPtr = allocate(size, dirtyBytes);
+        if (!newPtr) return nullptr;
+        memcpy(newPtr, ptr, std::min(malloc_usable_size(ptr), newSize));
+        release(ptr);
+        return newPtr;
+    }
+
+    void release(void* ptr)
+    {
+        ThreadCache* cache = getThreadCache();
+        countFree(cache);
+        SlabRun* run = findSlabRun(ptr);
+        MemoryBlock* block = run ? nullptr : getBlock(ptr);
+        if (block) checkLiveBlock(block);
+
+        if (block && block->hasFlag(FLAG_MMAPPED))
+        {
+            releaseMapped(reinterpret_cast<MmapBlock*>(block));
+            return;
+        }
+
+        // a foreign blk neither takes its owner's lock nor fills this thread's cache
+        HeapArena& arena = run ? *run->arena : getArena(block);
+        if (numArenas > 1 && &arena != &selectArena(cache))
+        {
+            pushRemoteFrees(arena, ptr, ptr, 1);
+            return;
+        }
+
+        size_t size = run ? run->objectSize : block->size();
+        if (cache && size < TCACHE_MAX_SIZE && tcacheLimits[size/SIZE_GRANULE])
+        {
+            addToThreadCache(*cache, size/SIZE_GRANULE, ptr);
+            return;
+        }
+
+        std::lock_guard<Mutex> lock(arena.mutex);
+        releaseToArena(arena, ptr);
+    }
+
+    // hardened builds abort on a header that was overwritten or a heap blk that is already free
+    static void checkLiveBlock(const MemoryBlock* block)
+    {
+        checkHeader(block);
+        if (HARDENED && block->hasFlag(FLAG_FREE)) reportMisuse("free(): double free detected");
+    }
+
+    void releaseMapped(MmapBlock* block)
+    {
+        // a size that is freed is likely to come back, serve it from the heap from now on
+        auto* header = reinterpret_cast<MemoryBlock*>(block);
+        size_t mappedSize = header->size();
+        if (header->hasFlag(FLAG_SAMPLED)) releaseSample(block);
+        else if (dynamicThresholds.load(std::memory_order_relaxed)
+            && mappedSize >= mmapThreshold.load(std::memory_order_relaxed) && mappedSize < MMAP_THRESHOLD_MAX)
+        {
+            mmapThreshold.store(mappedSize+SIZE_GRANULE, std::memory_order_relaxed);
+            // keep the freed buffer in the top instead of trimming it straight back
+            size_t trim = std::max(trimThreshold.load(std::memory_order_relaxed), 2*(mappedSize+SIZE_GRANULE));
+            trimThreshold.store(trim, std::memory_order_relaxed);
+        }
+        unmapBlock(block);
+    }
+
+    // `first` to `last` are already linked, the chain of `count` goes onto the owner's queue in one exchange;
+    // the owner drains it when allocating, which it never does once its threads are gone, so a long queue is
+    // drained here whenever the owner's lock happens to be free
+    void pushRemoteFrees(HeapArena& arena, void* first, void* last, size_t count)
+    {
+        void* head = arena.remoteFrees.load(std::memory_order_relaxed);
+        do
+        {
+            storeLink(last, head);
+        } while (!arena.remoteFrees.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+
+        auto queued = static_cast<std::ptrdiff_t>(count);
+        if (arena.remoteFreeCount.fetch_add(queued, std::memory_order_relaxed)+queued < REMOTE_DRAIN_THRESHOLD) return;
+        std::unique_lock<Mutex> lock(arena.mutex, std::try_to_lock);
+        if (lock) drainRemoteFrees(arena);
+    }
+
+    void flushCache(ThreadCache& cache)
+    {
+        for (size_t idx = 0; idx < NUM_TCACHE_BINS; ++idx)
+        {
+            if (cache.counts[idx]) flushThreadCacheBin(cache, idx, cache.counts[idx]);
+        }
+        if (cache.arena)
+        {
+            std::lock_guard<Mutex> lock(cache.arena->mutex);
+            drainRemoteFrees(*cache.arena);
+        }
+    }
+
+    // a thread caches for the first allocator it uses, other instances take the locked path
+    ThreadCache* getThreadCache()
+    {
+        if (!threadCache.owner)
+        {
+            threadCache.owner = this;
+            std::lock_guard<Mutex> lock(statsMutex);
+            threadCache.nextCache = threadCaches;
+            if (threadCaches) threadCaches->prevCache = &threadCache;
+            threadCaches = &threadCache;
+        }
+        return threadCache.owner == this && !threadCache.retired ? &threadCache : nullptr;
+    }
+
+    // fold the counts of a cache that goes away into the totals and unregister it
+    void retireThreadCache(ThreadCache& cache)
+    {
+        std::lock_guard<Mutex> lock(statsMutex);
+        retiredMallocCalls += cache.mallocCalls.exchange(0, std::memory_order_relaxed);
+        retiredFreeCalls += cache.freeCalls.exchange(0, std::memory_order_relaxed);
+        if (cache.prevCache) cache.prevCache->nextCache = cache.nextCache;
+        else threadCaches = cache.nextCache;
+        if (cache.nextCache) cache.nextCache->prevCache = cache.prevCache;
+        cache.nextCache = cache.prevCache = nullptr;
+    }
+
+    // split and merge counts, under the arena lock
+    static void countEvent(uint64_t& counter)
+    {
+        if constexpr (Config::STATS) ++counter;
+    }
+
+    static void countSyscall(std::atomic<uint64_t>& counter)
+    {
+        if constexpr (Config::STATS) counter.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the owner is the only writer of its counters, so no locked read-modify-write is needed
+    static void bumpCounter(std::atomic<uint64_t>& counter)
+    {
+        counter.store(counter.load(std::memory_order_relaxed)+1, std::memory_order_relaxed);
+    }
+
+    void countMalloc(ThreadCache* cache)
+    {
+        if constexpr (!Config::STATS) return;
+        if (cache) bumpCounter(cache->mallocCalls);
+        else uncachedMallocCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    void countFree(ThreadCache* cache)
+    {
+        if constexpr (!Config::STATS) return;
+        if (cache) bumpCounter(cache->freeCalls);
+        else uncachedFreeCalls.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    // the countdown ran out: draw the next one and, while sampling is on, map the request on its own with a
+    // record in front; nullptr sends it down the normal path
+    void* allocateSampled(ThreadCache& cache, size_t alignment, size_t size, size_t& dirtyBytes)
+    {
+        // a thread's first trip only seeds it, or every thread's first allocation would be sampled
+        bool firstTrip = !cache.sampleSeed;
+        if (firstTrip)
+        {
+            auto now = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+            cache.sampleSeed = (reinterpret_cast<std::uintptr_t>(&cache) ^ now) | 1;
+        }
+        size_t rate = profileSampleRate.load(std::memory_order_relaxed);
+        cache.bytesUntilSample = rate ? nextSampleInterval(cache.sampleSeed, rate) : PROFILE_RECHECK_BYTES;
+        if (!rate || firstTrip) return nullptr;
+
+        void* ptr = mapBlock(alignment, size, dirtyBytes, sizeof(SampleRecord));
+        if (!ptr) return nullptr;
+        auto* block = static_cast<MmapBlock*>(ptr)-1;
+        block->sizeAndFlags = sealHeader(block, block->sizeAndFlags | FLAG_SAMPLED);
+        SampleRecord* record = reinterpret_cast<SampleRecord*>(block)-1;
+        record->size = size;
+        auto sinceEpoch = std::chrono::system_clock::now().time_since_epoch();
+        record->timestampNanos = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count());
+        record->depth = captureStack(record->stack, MAX_STACK_DEPTH);
+        hasSampledBlocks.store(true, std::memory_order_relaxed);
+
+        std::lock_guard<Mutex> lock(profileMutex);
+        record->prev = nullptr;
+        record->next = liveSamples;
+        if (liveSamples) liveSamples->prev = record;
+        liveSamples = record;
+        ++liveSampleCount;
+        liveSampleBytes += size;
+        profiledRate = rate;
+        return ptr;
+    }
+
+    void releaseSample(MmapBlock* block)
+    {
+        SampleRecord* record = reinterpret_cast<SampleRecord*>(block)-1;
+        std::lock_guard<Mutex> lock(profileMutex);
+        if (record->prev) record->prev->next = record->next;
+        else liveSamples = record->next;
+        if (record->next) record->next->prev = record->prev;
+        --liveSampleCount;
+        liveSampleBytes -= record->size;
+    }
+
+    // exponentially distributed around `rate`, so every allocated byte has the same chance to be sampled
+    static std::ptrdiff_t nextSampleInterval(uint64_t& seed, size_t rate)
+    {
+        // xorshift64*
+        seed ^= seed >> 12;
+        seed ^= seed << 25;
+        seed ^= seed >> 27;
+        double uniform = static_cast<double>((seed*0x2545F4914F6CDD1DULL) >> 11) * 0x1p-53;
+        double interval = -std::log1p(-uniform) * static_cast<double>(rate);
+        return static_cast<std::ptrdiff_t>(std::min(interval, 0x1p62));
+    }
+
+    // return addresses from the unwind tables, so frame pointers are not needed; skips this frame
+    [[gnu::noinline]] static size_t captureStack(void** stack, size_t maxDepth)
+    {
+        struct Trace
+        {
+            void** stack;
+            size_t depth;
+            size_t maxDepth;
+            bool skipped;
+        } trace{stack, 0, maxDepth, false};
+        _Unwind_Backtrace([](_Unwind_Context* context, void* arg)
+        {
+            auto* trace = static_cast<Trace*>(arg);
+            auto ip = _Unwind_GetIP(context);
+            if (!ip) return _URC_END_OF_STACK;
+            if (!trace->skipped) trace->skipped = true;
+            else trace->stack[trace->depth++] = reinterpret_cast<void*>(ip);
+            return trace->depth == trace->maxDepth ? _URC_END_OF_STACK : _URC_NO_REASON;
+        }, &trace);
+        return trace.depth;
+    }
+
+    static uint64_t traceClock()
+    {
+        auto sinceEpoch = std::chrono::steady_clock::now().time_since_epoch();
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(sinceEpoch).count());
+    }
+
+    // stamped before the blk is released, once it is another thread can get the address and record it
+    void traceFree(void* ptr)
+    {
+        if (tracing.load(std::memory_order_relaxed)) recordTrace(TraceOp::Free, ptr, nullptr, 0, traceClock());
+    }
+
+    // threads that cache for another allocator aren't traced, they have no ring
+    void recordTrace(TraceOp op, const void* ptr, const void* oldPtr, size_t size, uint64_t timestampNanos, size_t alignment = 0)
+    {
+        ThreadCache* cache = getThreadCache();
+        if (!cache || cache->traceExempt) return;
+        if (!cache->traceRing && !(cache->traceRing = createTraceRing())) return;
+        TraceRing& ring = *cache->traceRing;
+        uint64_t head = ring.head.load(std::memory_order_relaxed);
+        while (head - ring.tail.load(std::memory_order_acquire) == TRACE_RING_RECORDS)
+        {
+            // the flusher drains the rings once more after tracing stops, but not again for this one
+            if (!tracing.load(std::memory_order_relaxed)) return;
+            sched_yield();
+        }
+        ring.records[head % TRACE_RING_RECORDS] = AllocationTraceRecord{
+            timestampNanos, reinterpret_cast<std::uintptr_t>(ptr), reinterpret_cast<std::uintptr_t>(oldPtr), size,
+            ring.threadId, op, static_cast<uint16_t>(alignment ? std::countr_zero(alignment) : 0)};
+        ring.head.store(head+1, std::memory_order_release);
+    }
+
+    TraceRing* createTraceRing()
+    {
+        void* memory = sysMmap(sizeof(TraceRing), PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS);
+        if (memory == MAP_FAILED) return nullptr;
+        auto* ring = new (memory) TraceRing;
+        std::lock_guard<std::mutex> lock(traceMutex);
+        ring->threadId = nextTraceThreadId++;
+        ring->next = traceRings;
+        traceRings = ring;
+        return ring;
+    }
+
+    static void* runTraceFlusher(void* allocator)
+    {
+        auto* self = static_cast<SbrkMemoryAllocator*>(allocator);
+        // its own frees would wait on its own ring
+        threadCache.traceExempt = true;
+        while (self->tracing.load(std::memory_order_acquire))
+        {
+            if (!self->flushTraceRings()) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        self->flushTraceRings();
+        return nullptr;
+    }
+
+    // one pass over the rings, unmapping those of exited threads once they are empty; a failed write still
+    // consumes the records so no thread is kept waiting; true if anything was written
+    bool flushTraceRings()
+    {
+        std::lock_guard<std::mutex> lock(traceMutex);
+        bool flushed = false;
+        for (TraceRing** link = &traceRings; *link;)
+        {
+            TraceRing* ring = *link;
+            // read before head, the thread's last record is published before it abandons the ring
+            bool abandoned = ring->abandoned.load(std::memory_order_acquire);
+            uint64_t head = ring->head.load(std::memory_order_acquire);
+            uint64_t tail = ring->tail.load(std::memory_order_relaxed);
+            while (tail != head)
+            {
+                size_t start = tail % TRACE_RING_RECORDS;
+                size_t count = std::min<uint64_t>(head-tail, TRACE_RING_RECORDS-start);
+                writeAll(traceFd, reinterpret_cast<const char*>(&ring->records[start]), count*sizeof(AllocationTraceRecord));
+                tail += count;
+                flushed = true;
+            }
+            ring->tail.store(tail, std::memory_order_release);
+
+            if (abandoned)
+            {
+                *link = ring->next;
+                sysMunmap(ring, sizeof(TraceRing));
+            }
+            else link = &ring->next;
+        }
+        return flushed;
+    }
+
+    HeapArena& selectArena(ThreadCache* cache)
+    {
+        ArenaSelection selection = arenaSelection.load(std::memory_order_relaxed);
+        if (selection == ArenaSelection::PerCpu)
+        {
+            int cpu = sched_getcpu();
+            return arenas[cpu < 0 ? 0 : static_cast<size_t>(cpu) % numArenas];
+        }
+        if (selection == ArenaSelection::PerNode)
+        {
+            // the k-th online node owns arenas k, k+nodes, k+2*nodes..., the first ones taking the arenas left over
+            // by an uneven split; the cpu spreads the node's threads over them
+            unsigned cpu, node;
+            if (getcpu(&cpu, &node) != 0) cpu = node = 0;
+            size_t nodes = numaNodes.load(std::memory_order_relaxed);
+            size_t index = (node < MAX_NUMA_NODES ? numaNodeIndex[node].load(std::memory_order_relaxed) : 0) % nodes;
+            size_t owned = (numArenas-index + nodes-1)/nodes;
+            return arenas[index + nodes*(cpu % owned)];
+        }
+        if (!cache) return arenas[0];
+        if (!cache->arena) cache->arena = &arenas[nextArena.fetch_add(1, std::memory_order_relaxed) % numArenas];
+        return *cache->arena;
+    }
+
+    size_t blockUsableSize(void* ptr) const
+    {
+        if (SlabRun* run = findSlabRun(ptr)) return run->objectSize;
+        return getBlock(ptr)->size();
+    }
+
+    static MemoryBlock* getBlock(void* ptr)
+    {
+        return reinterpret_cast<MemoryBlock*>(static_cast<char*>(ptr) - sizeof(MemoryBlock));
+    }
+
+    HeapArena& getOwnerArena(void* ptr)
+    {
+        if (SlabRun* run = findSlabRun(ptr)) return *run->arena;
+        return getArena(getBlock(ptr));
+    }
+
+    // the owner of a slab object or heap blk by its address alone, never reading the blk's header
+    HeapArena& findUnmappedOwner(void* ptr)
+    {
+        if (SlabRun* run = findSlabRun(ptr)) return *run->arena;
+        auto* p = static_cast<char*>(ptr);
+        if (p > mainHeapStart.load(std::memory_order_relaxed) && p < mainHeapEnd.load(std::memory_order_relaxed)) return arenas[0];
+        auto chunkStart = reinterpret_cast<std::uintptr_t>(ptr) & ~(ARENA_CHUNK_SIZE-1);
+        return *reinterpret_cast<ArenaChunk*>(chunkStart)->arena;
+    }
+
+    HeapArena& getArena(MemoryBlock* block)
+    {
+        if (!block->hasFlag(FLAG_NON_MAIN_ARENA)) return arenas[0];
+        auto chunkStart = reinterpret_cast<std::uintptr_t>(block) & ~(ARENA_CHUNK_SIZE-1);
+        return *reinterpret_cast<ArenaChunk*>(chunkStart)->arena;
+    }
+
+    // move spare payloads of exactly `size` that are already free in the arena into the cache, lock held
+    void refillThreadCache(HeapArena& arena, ThreadCache& cache, size_t size)
+    {
+        size_t idx = size/SIZE_GRANULE;
+        uint32_t batch = tcacheLimits[idx]/2;
+        bool fromSlab = size <= slabLimit.load(std::memory_order_relaxed);
+        while (cache.counts[idx] < batch)
+        {
+            void* ptr;
+            if (fromSlab)
+            {
+                if (!arena.partialRuns[getSlabClass(size)]) break;
+                size_t dirtyBytes;
+                ptr = allocateFromSlab(arena, size, dirtyBytes);
+            }
+            else
+            {
+                MemoryBlock* block = arena.freeBins[idx];
+                if (!block) break;
+                removeFromFreeList(arena, block);
+                block->setFlag(FLAG_FREE, false);
+                updateBoundaryTag(block);
+                ptr = block+1;
+            }
+            pushThreadCache(cache, idx, ptr);
+        }
+    }
+
+    void flushThreadCacheBin(ThreadCache& cache, size_t idx, uint32_t count)
+    {
+        // consecutive blks usually share an arena, so the lock is only swapped when the owner changes
+        HeapArena* lockedArena = nullptr;
+        std::unique_lock<Mutex> lock;
+        while (count-- && cache.bins[idx])
+        {
+            void* ptr = popThreadCache(cache, idx);
+            HeapArena& arena = getOwnerArena(ptr);
+            if (&arena != lockedArena)
+            {
+                // release before taking the next one, holding two arena locks could deadlock
+                if (lock) lock.unlock();
+                lock = std::unique_lock<Mutex>(arena.mutex);
+                lockedArena = &arena;
+            }
+            releaseToArena(arena, ptr);
+        }
+    }
+
+    void addToThreadCache(ThreadCache& cache, size_t idx, void* ptr)
+    {
+        // the key only says the payload may be cached, the bin is walked to be sure
+        if (HARDENED && static_cast<uint64_t*>(ptr)[1] == getSecrets().cacheKey)
+        {
+            void* cached = cache.bins[idx];
+            for (uint32_t i = 0; cached && i < cache.counts[idx]; ++i, cached = loadLink<void>(cached))
+            {
+                if (cached == ptr) reportMisuse("free(): double free detected in thread cache");
+            }
+        }
+        if (cache.counts[idx] >= tcacheLimits[idx]) flushThreadCacheBin(cache, idx, (tcacheLimits[idx]+1)/2);
+        pushThreadCache(cache, idx, ptr);
+    }
+
+    // hardened builds tag cached payloads with a key in their second word, so a second free can spot itself
+    void pushThreadCache(ThreadCache& cache, size_t idx, void* ptr)
+    {
+        storeLink(ptr, cache.bins[idx]);
+        if constexpr (HARDENED) static_cast<uint64_t*>(ptr)[1] = getSecrets().cacheKey;
+        cache.bins[idx] = ptr;
+        ++cache.counts[idx];
+    }
+
+    void* popThreadCache(ThreadCache& cache, size_t idx)
+    {
+        void* ptr = cache.bins[idx];
+        cache.bins[idx] = loadLink<void>(ptr);
+        if constexpr (HARDENED) static_cast<uint64_t*>(ptr)[1] = 0;
+        --cache.counts[idx];
+        return ptr;
+    }
+
+    // SBRK_DEBUG builds abort when a sized free claims more than the blk holds, which would let a later
+    // request overrun it
+    void checkFreedSize([[maybe_unused]] void* ptr, [[maybe_unused]] size_t blockSize) const
+    {
+#ifdef SBRK_DEBUG
+        if (blockSize > blockUsableSize(ptr)) reportMisuse("free_sized: size is larger than the allocation");
+#endif
+    }
+
+    [[noreturn]] static void reportMisuse(const char* message)
+    {
+        // no stdio, it could allocate from the heap that is being misused
+        [[maybe_unused]] ssize_t written = write(STDERR_FILENO, message, strlen(message));
+        written = write(STDERR_FILENO, "\n", 1);
+        abort();
+    }
+
+    // keys of the hardened checks, drawn once per process on first use; a fork child keeps its parent's
+    struct Secrets
+    {
+        uint64_t header;
+        uint64_t cacheKey;
+        uint64_t canary;
+    };
+    static const Secrets& getSecrets()
+    {
+        static const Secrets secrets = []
+        {
+            Secrets keys;
+            if (getrandom(&keys, sizeof(keys), GRND_NONBLOCK) != static_cast<ssize_t>(sizeof(keys)))
+            {
+                // no entropy this early in boot, a clock and an address are better than a constant
+                auto now = static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+                uint64_t seed = (now ^ reinterpret_cast<std::uintptr_t>(&keys)) | 1;
+                keys = {mixKey(seed), mixKey(seed+1), mixKey(seed+2)};
+            }
+            keys.cacheKey |= 1; // never zero, popped payloads are tagged with that
+            return keys;
+        }();
+        return secrets;
+    }
+
+    static uint64_t mixKey(uint64_t value)
+    {
+        value *= 0x9e3779b97f4a7c15;
+        return value ^ (value >> 29);
+    }
+
+    // the check bits cover the header's address too, so a header copied elsewhere is caught as well
+    static size_t headerCheck(const void* header, size_t word)
+    {
+        if constexpr (!HARDENED) return 0;
+        return mixKey(reinterpret_cast<std::uintptr_t>(header) ^ word ^ getSecrets().header) & CHECK_MASK;
+    }
+
+    static size_t sealHeader(const void* header, size_t word)
+    {
+        word &= ~CHECK_MASK;
+        return word | headerCheck(header, word);
+    }
+
+    static void checkHeader(const MemoryBlock* block)
+    {
+        size_t word = block->load();
+        if (HARDENED && (word & CHECK_MASK) != headerCheck(block, word & ~CHECK_MASK))
+        {
+            reportMisuse("corrupted blk header or invalid pointer");
+        }
+    }
+
+    // links of the singly linked lists; hardened builds store them xor'ed with the slot's address shifted past
+    // the page offset, so an overwrite yields a misaligned pointer rather than a chosen one
+    static void storeLink(void* slot, void* next)
+    {
+        *static_cast<void**>(slot) = maskLink(slot, next);
+    }
+
+    template <typename T>
+    static T* loadLink(void* slot)
+    {
+        void* next = maskLink(slot, *static_cast<void**>(slot));
+        if (HARDENED && (reinterpret_cast<std::uintptr_t>(next) & (SIZE_GRANULE-1))) reportMisuse("corrupted free list");
+        return static_cast<T*>(next);
+    }
+
+    static void* maskLink(void* slot, void* link)
+    {
+        if constexpr (!HARDENED) return link;
+        return reinterpret_cast<void*>((reinterpret_cast<std::uintptr_t>(slot) >> 12) ^ reinterpret_cast<std::uintptr_t>(link));
+    }
+
+    // the canary goes right after the `size` bytes asked for, the size itself in the blk's last word
+    void writeCanary(void* ptr, size_t size) const
+    {
+        if constexpr (!CANARIES) return;
+        auto* payload = static_cast<char*>(ptr);
+        uint64_t sizeWord = size ^ getSecrets().canary;
+        uint64_t canary = mixKey(reinterpret_cast<std::uintptr_t>(ptr) ^ size ^ getSecrets().canary);
+        memcpy(payload+blockUsableSize(ptr)-sizeof(sizeWord), &sizeWord, sizeof(sizeWord));
+        memcpy(payload+size, &canary, sizeof(canary));
+    }
+
+    // returns the size the blk was requested with
+    size_t checkCanary(void* ptr) const
+    {
+        auto* payload = static_cast<char*>(ptr);
+        size_t usable = blockUsableSize(ptr);
+        uint64_t sizeWord;
+        memcpy(&sizeWord, payload+usable-sizeof(sizeWord), sizeof(sizeWord));
+        size_t size = sizeWord ^ getSecrets().canary;
+        uint64_t canary = 0;
+        if (size <= usable-CANARY_SIZE) memcpy(&canary, payload+size, sizeof(canary));
+        if (canary != mixKey(reinterpret_cast<std::uintptr_t>(ptr) ^ size ^ getSecrets().canary))
+        {
+            reportMisuse("heap buffer overflow past the requested size");
+        }
+        return size;
+    }
+
+    static size_t addCanaryRoom(size_t size)
+    {
+        return std::min(size, SIZE_MAX-CANARY_SIZE) + CANARY_SIZE;
+    }
+
+    // arena paths below expect the arena's mutex to be held
+
+    // the whole list is taken in one exchange, so pushes racing with it can't cause ABA
+    void drainRemoteFrees(HeapArena& arena)
+    {
+        if (!arena.remoteFrees.load(std::memory_order_relaxed)) return;
+        void* ptr = arena.remoteFrees.exchange(nullptr, std::memory_order_acquire);
+        std::ptrdiff_t drained = 0;
+        for (; ptr; ++drained)
+        {
+            void* next = loadLink<void>(ptr);
+            releaseToArena(arena, ptr);
+            ptr = next;
+        }
+        arena.remoteFreeCount.fetch_sub(drained, std::memory_order_relaxed);
+    }
+
+    void* allocateFromArena(HeapArena& arena, size_t size, size_t& dirtyBytes)
+    {
+        if (size <= slabLimit.load(std::memory_order_relaxed))
+        {
+            // fall through to the heap when the slab region is exhausted
+            if (void* ptr = allocateFromSlab(arena, size, dirtyBytes)) return ptr;
+        }
+        MemoryBlock* block = allocateFromHeap(arena, size, dirtyBytes);
+        // user should not have access to metadata of the memory block; possible overwriting metadata
+        return block ? reinterpret_cast<void*>(block+1) : nullptr;
+    }
+
+    // fills `out` with `count` blks of exactly `size` bytes as far as memory allows
+    size_t allocateBatchFromArena(HeapArena& arena, size_t size, size_t count, void** out)
+    {
+        size_t allocated = size <= slabLimit.load(std::memory_order_relaxed) ? allocateSlabBatch(arena, size, count, out) : 0;
+        size_t dirtyBytes;
+        while (allocated < count && size < FAST_BIN_MAX_SIZE && arena.fastBins[size/SIZE_GRANULE])
+        {
+            out[allocated++] = allocateFromHeap(arena, size, dirtyBytes)+1;
+        }
+        while (allocated < count)
+        {
+            // as many as a heap blk may hold at once, or one at a time once no blk that large can be had
+            size_t batch = std::min(count-allocated, MMAP_THRESHOLD_MAX/(size+sizeof(MemoryBlock)));
+            if (batch > 1 && carveBatch(arena, size, batch, out+allocated))
+            {
+                allocated += batch;
+                continue;
+            }
+            void* ptr = allocateFromArena(arena, size, dirtyBytes);
+            if (!ptr) break;
+            out[allocated++] = ptr;
+        }
+        return allocated;
+    }
+
+    // one blk large enough for `count` of them, headers included, split into consecutive blks in a single pass
+    bool carveBatch(HeapArena& arena, size_t size, size_t count, void** out)
+    {
+        size_t stride = size+sizeof(MemoryBlock);
+        size_t dirtyBytes;
+        MemoryBlock* block = allocateFromHeap(arena, count*stride - sizeof(MemoryBlock), dirtyBytes);
+        if (!block) return false;
+
+        auto* mem = reinterpret_cast<char*>(block);
+        size_t flags = block->load() & FLAG_NON_MAIN_ARENA;
+        size_t lastSize = block->size() - (count-1)*stride;
+        block->setSize(size);
+        out[0] = block+1;
+        for (size_t i = 1; i < count; ++i)
+        {
+            // the last one keeps whatever the fit left over until it is trimmed
+            MemoryBlock* next = initialiseBlock(mem + i*stride, i+1 < count ? size : lastSize, flags);
+            out[i] = next+1;
+            countEvent(arena.splits);
+        }
+        trimBlock(arena, getBlock(out[count-1]), size);
+        return true;
+    }
+
+    // freed objects of a run first, then a contiguous stretch of its untouched ones
+    size_t allocateSlabBatch(HeapArena& arena, size_t size, size_t count, void** out)
+    {
+        size_t slabClass = getSlabClass(size);
+        size_t allocated = 0;
+        while (allocated < count)
+        {
+            SlabRun* run = arena.partialRuns[slabClass];
+            if (!run)
+            {
+                run = acquireSlabRun(arena, size);
+                if (!run) break;
+                pushPartialRun(arena, slabClass, run);
+            }
+
+            uint32_t taken = 0;
+            for (; allocated < count && run->freeList; ++taken)
+            {
+                out[allocated++] = run->freeList;
+                run->freeList = loadLink<void>(run->freeList);
+            }
+            // with the free list drained, every free object left was never handed out
+            for (; allocated < count && taken < run->freeCount; ++taken)
+            {
+                out[allocated++] = run->bumpNext;
+                run->bumpNext += run->objectSize;
+            }
+            run->freeCount -= taken;
+            arena.slabBytesInUse += taken*run->objectSize;
+            if (run->freeCount == 0) removePartialRun(arena, slabClass, run);
+        }
+        return allocated;
+    }
+
+    void releaseToArena(HeapArena& arena, void* ptr)
+    {
+        if (SlabRun* run = findSlabRun(ptr))
+        {
+            freeToSlab(arena, run, ptr);
+        }
+        else
+        {
+            MemoryBlock* block = getBlock(ptr);
+            if (!addToFastBin(arena, block)) releaseToHeap(arena, block);
+        }
+    }
+
+    static size_t getSlabClass(size_t size)
+    {
+        return size/SIZE_GRANULE - 1;
+    }
+
+    SlabRun* findSlabRun(void* ptr) const
+    {
+        char* base = slabRegionBase.load(std::memory_order_relaxed);
+        auto* p = static_cast<char*>(ptr);
+        if (!base || p < base || p >= base+SLAB_REGION_SIZE) return nullptr;
+        auto runStart = reinterpret_cast<std::uintptr_t>(p) & ~(SLAB_RUN_SIZE-1);
+        return reinterpret_cast<SlabRun*>(runStart);
+    }
+
+    void* allocateFromSlab(HeapArena& arena, size_t size, size_t& dirtyBytes)
+    {
+        size_t slabClass = getSlabClass(size);
+        SlabRun* run = arena.partialRuns[slabClass];
+        if (!run)
+        {
+            run = acquireSlabRun(arena, size);
+            if (!run) return nullptr;
+            pushPartialRun(arena, slabClass, run);
+        }
+
+        void* ptr;
+        if (run->freeList)
+        {
+            ptr = run->freeList;
+            run->freeList = loadLink<void>(ptr);
+            dirtyBytes = run->objectSize;
+        }
+        else
+        {
+            // untouched objects are handed out in order, so a new run never has to build its free list;
+            // runs come from fresh or madvised pages, so these objects are still zero
+            ptr = run->bumpNext;
+            run->bumpNext += run->objectSize;
+            dirtyBytes = 0;
+        }
+        if (--run->freeCount == 0) removePartialRun(arena, slabClass, run);
+        arena.slabBytesInUse += run->objectSize;
+        return ptr;
+    }
+
+    void freeToSlab(HeapArena& arena, SlabRun* run, void* ptr)
+    {
+        size_t slabClass = getSlabClass(run->objectSize);
+        if (HARDENED && ptr == run->freeList) reportMisuse("free(): double free detected in slab run");
+        storeLink(ptr, run->freeList);
+        run->freeList = ptr;
+        if (run->freeCount++ == 0) pushPartialRun(arena, slabClass, run);
+        arena.slabBytesInUse -= run->objectSize;
+
+        // keep the last run of a class around so a single alloc/free pair does not churn runs
+        if (run->freeCount == run->capacity && (run->prevRun || run->nextRun))
+        {
+            removePartialRun(arena, slabClass, run);
+            releaseSlabRun(run);
+        }
+    }
+
+    static void pushPartialRun(HeapArena& arena, size_t slabClass, SlabRun* run)
+    {
+        run->prevRun = nullptr;
+        run->nextRun = arena.partialRuns[slabClass];
+        if (run->nextRun) run->nextRun->prevRun = run;
+        arena.partialRuns[slabClass] = run;
+    }
+
+    static void removePartialRun(HeapArena& arena, size_t slabClass, SlabRun* run)
+    {
+        if (run->prevRun) run->prevRun->nextRun = run->nextRun;
+        else arena.partialRuns[slabClass] = run->nextRun;
+        if (run->nextRun) run->nextRun->prevRun = run->prevRun;
+        run->nextRun = run->prevRun = nullptr;
+    }
+
+    SlabRun* acquireSlabRun(HeapArena& arena, size_t size)
+    {
+        SlabRun* run = nullptr;
+        {
+            std::lock_guard<Mutex> lock(slabRegionMutex);
+            if (numUnusedRuns)
+            {
+                char* base = slabRegionBase.load(std::memory_order_relaxed);
+                run = reinterpret_cast<SlabRun*>(base + size_t{unusedRuns[--numUnusedRuns]}*SLAB_RUN_SIZE);
+                growFootprint(counters.slabBytes, SLAB_RUN_SIZE);
+            }
+            else
+            {
+                char* mem = carveSlabRegion();
+                if (!mem) return nullptr;
+                run = reinterpret_cast<SlabRun*>(mem);
+            }
+        }
+
+        auto* runStart = reinterpret_cast<char*>(run);
+        run->arena = &arena;
+        run->nextRun = run->prevRun = nullptr;
+        run->freeList = nullptr;
+        run->bumpNext = runStart+SLAB_RUN_HEADER_SIZE;
+        run->objectSize = static_cast<uint32_t>(size);
+        run->capacity = static_cast<uint32_t>((SLAB_RUN_SIZE-SLAB_RUN_HEADER_SIZE)/size);
+        run->freeCount = run->capacity;
+        return run;
+    }
+
+    // give the pages back to the kernel but keep the address space for the next run; nothing may touch the
+    // run afterwards, so its index goes on the side stack; where pages are larger than a run the advice fails
+    // and the run is zeroed instead, which keeps new runs zero
+    void releaseSlabRun(SlabRun* run)
+    {
+        auto* runStart = reinterpret_cast<char*>(run);
+        if (sysMadvise(run, SLAB_RUN_SIZE, MADV_DONTNEED) != 0) memset(runStart, 0, SLAB_RUN_SIZE);
+        counters.slabBytes.fetch_sub(SLAB_RUN_SIZE, std::memory_order_relaxed);
+        std::lock_guard<Mutex> lock(slabRegionMutex);
+        char* base = slabRegionBase.load(std::memory_order_relaxed);
+        unusedRuns[numUnusedRuns++] = static_cast<uint32_t>((runStart-base)/SLAB_RUN_SIZE);
+    }
+
+    // next never-used run of the region, reserving the region and committing pages as needed, slab lock held
+    char* carveSlabRegion()
+    {
+        if (slabRegionFailed) return nullptr;
+        if (!slabRegionTop)
+        {
+            // one slot per run of the region, only the pages the stack reaches ever get backed
+            size_t stackBytes = SLAB_REGION_SIZE/SLAB_RUN_SIZE*sizeof(uint32_t);
+            void* stack = sysMmap(stackBytes, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE);
+            void* mem = stack == MAP_FAILED ? MAP_FAILED : sysMmap(SLAB_REGION_SIZE, PROT_NONE, MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE);
+            if (mem == MAP_FAILED)
+            {
+                if (stack != MAP_FAILED) sysMunmap(stack, stackBytes);
+                slabRegionFailed = true;
+                return nullptr;
+            }
+            unusedRuns = static_cast<uint32_t*>(stack);
+            slabRegionTop = slabRegionCommitted = static_cast<char*>(mem);
+            slabRegionBase.store(slabRegionTop, std::memory_order_relaxed);
+        }
+
+        char* regionEnd = slabRegionBase.load(std::memory_order_relaxed)+SLAB_REGION_SIZE;
+        if (slabRegionTop == regionEnd) return nullptr;
+        if (slabRegionTop == slabRegionCommitted)
+        {
+            if (sysMprotect(slabRegionCommitted, SLAB_COMMIT_SIZE, PROT_READ|PROT_WRITE) != 0) return nullptr;
+            slabRegionCommitted += SLAB_COMMIT_SIZE;
+            growFootprint(counters.slabBytes, SLAB_COMMIT_SIZE);
+        }
+
+        char* run = slabRegionTop;
+        slabRegionTop += SLAB_RUN_SIZE;
+        return run;
+    }
+
+    // heap paths below expect the arena's mutex to be held
+    MemoryBlock* allocateFromHeap(HeapArena& arena, size_t size, size_t& dirtyBytes)
+    {
+        if (size < FAST_BIN_MAX_SIZE && arena.fastBins[size/SIZE_GRANULE])
+        {
+            MemoryBlock*& head = arena.fastBins[size/SIZE_GRANULE];
+            MemoryBlock* block = head;
+            head = loadLink<MemoryBlock>(block+1);
+            arena.fastBinBytes -= block->size();
+            dirtyBytes = block->size();
+            return block;
+        }
+
+        MemoryBlock* freeBlock = findFreeBloc(arena, size);
+        bool hasRoom = arena.top && arena.top->size() >= size+MIN_USEABLE_SIZE;
+        // merge the deferred blks before growing, they may well form a fit
+        if (!freeBlock && !hasRoom && arena.fastBinBytes)
+        {
+            consolidateFastBins(arena);
+            freeBlock = findFreeBloc(arena, size);
+            hasRoom = arena.top && arena.top->size() >= size+MIN_USEABLE_SIZE;
+        }
+
+        if (freeBlock)
+        {
+            // unlink before splitting, the bin is derived from the current size
+            removeFromFreeList(arena, freeBlock);
+            freeBlock->setFlag(FLAG_FREE, false);
+            if (shouldSplitBlock(freeBlock, size)) splitBlock(arena, freeBlock, size);
+            updateBoundaryTag(freeBlock);
+            dirtyBytes = freeBlock->size();
+            return freeBlock;
+        }
+
+        // bins missed, carve from the top and grow it by a whole step when it is too small
+        if (!hasRoom && !(arena.isMainArena ? growMainHeap(arena, size) : mapArenaChunk(arena))) return nullptr;
+        return carveFromTop(arena, size, dirtyBytes);
+    }
+
+    MemoryBlock* carveFromTop(HeapArena& arena, size_t size, size_t& dirtyBytes)
+    {
+        MemoryBlock* block = arena.top;
+        auto* payload = reinterpret_cast<char*>(block+1);
+        size_t remainder = block->size() - size - sizeof(MemoryBlock);
+        arena.top = initialiseBlock(payload+size, remainder, FLAG_FREE | (block->load() & FLAG_NON_MAIN_ARENA));
+        block->setSize(size);
+        block->setFlag(FLAG_FREE, false);
+        updateBoundaryTag(arena.top);
+        countEvent(arena.splits);
+
+        dirtyBytes = arena.topCleanFrom > payload ? std::min<size_t>(arena.topCleanFrom-payload, size) : 0;
+        arena.topCleanFrom = std::max(arena.topCleanFrom, reinterpret_cast<char*>(arena.top+1));
+        return block;
+    }
+
+    void releaseToHeap(HeapArena& arena, MemoryBlock* block)
+    {
+        block->setFlag(FLAG_FREE, true);
+        block = coalesce(arena, block);
+        if (block != arena.top) addToFreeList(arena, block);
+        updateBoundaryTag(block);
+
+        size_t threshold = trimThreshold.load(std::memory_order_relaxed);
+        if (block == arena.top && arena.isMainArena && threshold && block->size() >= threshold)
+        {
+            shrinkMainHeap(arena, heapGrowthSize.load(std::memory_order_relaxed));
+        }
+    }
+
+    // a freed blk goes to a fast bin while deferral is on and the bin's size is covered
+    bool addToFastBin(HeapArena& arena, MemoryBlock* block)
+    {
+        size_t limit = fastBinLimit.load(std::memory_order_relaxed);
+        if (!limit || block->size() >= FAST_BIN_MAX_SIZE) return false;
+
+        MemoryBlock*& head = arena.fastBins[block->size()/SIZE_GRANULE];
+        if (HARDENED && block == head) reportMisuse("free(): double free detected in fast bin");
+        storeLink(block+1, head);
+        head = block;
+        arena.fastBinBytes += block->size();
+        if (arena.fastBinBytes > limit) consolidateFastBins(arena);
+        return true;
+    }
+
+    void consolidateFastBins(HeapArena& arena)
+    {
+        for (MemoryBlock*& head : arena.fastBins)
+        {
+            while (MemoryBlock* block = head)
+            {
+                head = loadLink<MemoryBlock>(block+1);
+                releaseToHeap(arena, block);
+            }
+        }
+        arena.fastBinBytes = 0;
+    }
+
+    bool trimArena(HeapArena& arena, size_t pad)
+    {
+        drainRemoteFrees(arena);
+        consolidateFastBins(arena);
+        bool released = false;
+        if (arena.top)
+        {
+            if (arena.isMainArena) released = shrinkMainHeap(arena, pad);
+            // the break could not move (or this is a chunk), drop the pages instead, which reads back as zero
+            if (!released && (released = adviseFreePages(arena.top, pad)))
+            {
+                // the partial page before the fencepost keeps its bytes, clear what of it was written before
+                // moving the clean mark below the advised pages
+                auto* topPayload = reinterpret_cast<char*>(arena.top+1);
+                char* topEnd = topPayload+arena.top->size();
+                char* advisedStart = alignUp(topPayload+std::max(pad, sizeof(TreeLinks)), getPageSize());
+                char* advisedEnd = alignDown(topEnd, getPageSize());
+                char* dirtyEnd = std::min(arena.topCleanFrom, topEnd);
+                if (dirtyEnd > advisedEnd) memset(advisedEnd, 0, static_cast<size_t>(dirtyEnd-advisedEnd));
+                arena.topCleanFrom = std::min(arena.topCleanFrom, advisedStart);
+            }
+        }
+
+        // nothing in a chunk is bigger than its capacity, so any fit for that is a whole free chunk
+        while (MemoryBlock* block = arena.isMainArena ? nullptr : findFreeBloc(arena, ARENA_CHUNK_CAPACITY))
+        {
+            removeFromFreeList(arena, block);
+            sysMunmap(reinterpret_cast<char*>(block)-ARENA_CHUNK_HEADER_SIZE, ARENA_CHUNK_SIZE);
+            counters.chunkBytes.fetch_sub(ARENA_CHUNK_SIZE, std::memory_order_relaxed);
+            released = true;
+        }
+
+        // only blks spanning two pages can have a whole page inside them
+        for (size_t idx = findNonEmptyBin(arena, getBinIndex(2*getPageSize())); idx < NUM_BINS; idx = findNonEmptyBin(arena, idx+1))
+        {
+            forEachFreeBlock(arena.freeBins[idx], isTreeBin(idx), [&](MemoryBlock* block) { released |= adviseFreePages(block, 0); });
+        }
+        return released;
+    }
+
+    // lower the break so the top keeps `pad` bytes, only while nobody else has moved it
+    bool shrinkMainHeap(HeapArena& arena, size_t pad)
+    {
+        auto* topPayload = reinterpret_cast<char*>(arena.top+1);
+        char* newEnd = alignUp(topPayload+std::max(pad, MIN_PAYLOAD_SIZE)+sizeof(MemoryBlock), getPageSize());
+        if (newEnd >= arena.heapEnd || sbrk(0) != arena.heapEnd) return false;
+        if (sysSbrk(-static_cast<std::intptr_t>(arena.heapEnd-newEnd)) == reinterpret_cast<void*>(static_cast<std::intptr_t>(-1))) return false;
+        counters.sbrkBytes.fetch_sub(static_cast<size_t>(arena.heapEnd-newEnd), std::memory_order_relaxed);
+
+        arena.heapEnd = newEnd;
+        mainHeapEnd.store(newEnd, std::memory_order_relaxed);
+        MemoryBlock* fencepost = initialiseBlock(newEnd-sizeof(MemoryBlock), 0, 0);
+        arena.top->setSize(reinterpret_cast<char*>(fencepost)-topPayload);
+        updateBoundaryTag(arena.top);
+        // regrowing clears the fencepost, and everything past it comes back as fresh pages
+        arena.topCleanFrom = std::min(arena.topCleanFrom, reinterpret_cast<char*>(fencepost));
+        return true;
+    }
+
+    // MADV_DONTNEED the whole pages of a free blk past its list or tree links and the first `keep` bytes
+    bool adviseFreePages(MemoryBlock* block, size_t keep)
+    {
+        size_t pageSize = getPageSize();
+        auto* payload = reinterpret_cast<char*>(block+1);
+        char* start = alignUp(payload+std::max(keep, sizeof(TreeLinks)), pageSize);
+        char* end = alignDown(payload+block->size(), pageSize);
+        if (end <= start) return false;
+        return sysMadvise(start, static_cast<size_t>(end-start), MADV_DONTNEED) == 0;
+    }
+
+    static char* alignUp(char* ptr, size_t alignment)
+    {
+        return reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(ptr) + alignment-1) & ~(alignment-1));
+    }
+
+    static char* alignDown(char* ptr, size_t alignment)
+    {
+        return reinterpret_cast<char*>(reinterpret_cast<std::uintptr_t>(ptr) & ~(alignment-1));
+    }
+
+    // give the tail of an allocated blk beyond `size` back to the heap, merging it with a free successor
+    void trimBlock(HeapArena& arena, MemoryBlock* block, size_t size)
+    {
+        if (!shouldSplitBlock(block, size)) return;
+        auto* payloadStart = reinterpret_cast<char*>(block+1);
+        size_t remainder = block->size() - size - sizeof(MemoryBlock);
+        MemoryBlock* tail = initialiseBlock(payloadStart+size, remainder, block->load() & FLAG_NON_MAIN_ARENA);
+        block->setSize(size);
+        countEvent(arena.splits);
+        releaseToHeap(arena, tail);
+    }
+
+    bool resizeInPlace(HeapArena& arena, MemoryBlock* block, size_t size)
+    {
+        if (size <= block->size())
+        {
+            trimBlock(arena, block, size);
+            return true;
+        }
+
+        MemoryBlock* next = getNextAdjacent(block);
+        size_t available = block->size()+sizeof(MemoryBlock)+next->size();
+        if (next == arena.top)
+        {
+            // the top (grown first if needed) gives up its front and moves up
+            if (available < size+MIN_USEABLE_SIZE)
+            {
+                if (!arena.isMainArena || !growMainHeap(arena, size-block->size())) return false;
+                if (getNextAdjacent(block) != arena.top) return resizeInPlace(arena, block, size);
+                available = block->size()+sizeof(MemoryBlock)+arena.top->size();
+            }
+            auto* newTop = reinterpret_cast<char*>(block+1)+size;
+            arena.top = initialiseBlock(newTop, available-size-sizeof(MemoryBlock), FLAG_FREE | (block->load() & FLAG_NON_MAIN_ARENA));
+            block->setSize(size);
+            updateBoundaryTag(arena.top);
+            arena.topCleanFrom = std::max(arena.topCleanFrom, reinterpret_cast<char*>(arena.top+1));
+            return true;
+        }
+
+        if (!next->hasFlag(FLAG_FREE) || available < size) return false;
+        removeFromFreeList(arena, next);
+        block->setSize(available);
+        updateBoundaryTag(block);
+        trimBlock(arena, block, size);
+        return true;
+    }
+
+    // move the break by at least a growth step so the top can hold `size`; a contiguous step just
+    // extends the top, otherwise the old top is binned and a new segment starts
+    bool growMainHeap(HeapArena& arena, size_t size)
+    {
+        // a heap that grows is a process still allocating, let expired mappings go on the way
+        evictCachedMappings(0);
+        size_t pageSize = getPageSize();
+        size_t wanted = std::max(heapGrowthSize.load(std::memory_order_relaxed), size+MIN_USEABLE_SIZE+2*sizeof(MemoryBlock)+SIZE_GRANULE);
+        auto currentBreak = reinterpret_cast<std::uintptr_t>(sbrk(0));
+        size_t increment = ((currentBreak+wanted + pageSize-1) & ~(pageSize-1)) - currentBreak;
+        void* mem = sysSbrk(static_cast<std::intptr_t>(increment));
+        if (mem == reinterpret_cast<void*>(static_cast<std::intptr_t>(-1))) return false;
+        growFootprint(counters.sbrkBytes, increment);
+        auto* start = static_cast<char*>(mem);
+
+        if (start == arena.heapEnd)
+        {
+            // the top absorbs the old fencepost; clear it so the top stays clean past topCleanFrom
+            memset(start-sizeof(MemoryBlock), 0, sizeof(MemoryBlock));
+            arena.top->setSize(arena.top->size()+increment);
+        }
+        else
+        {
+            if (arena.top) addToFreeList(arena, arena.top);
+            size_t pad = -reinterpret_cast<std::uintptr_t>(start) & (SIZE_GRANULE-1);
+            arena.top = initialiseBlock(start+pad, increment-pad-2*sizeof(MemoryBlock), FLAG_FREE);
+            // pages past the old break are fresh, but a partial page below it may have been used before
+            auto* firstFreshPage = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(start) + pageSize-1) & ~(pageSize-1));
+            arena.topCleanFrom = std::max(firstFreshPage, reinterpret_cast<char*>(arena.top+1));
+        }
+
+        arena.heapEnd = start+increment;
+        if (!mainHeapStart.load(std::memory_order_relaxed)) mainHeapStart.store(start, std::memory_order_relaxed);
+        mainHeapEnd.store(arena.heapEnd, std::memory_order_relaxed);
+        initialiseBlock(arena.heapEnd-sizeof(MemoryBlock), 0, 0);
+        updateBoundaryTag(arena.top);
+        return true;
+    }
+
+    // whole ARENA_CHUNK_SIZE multiples, so the huge page setting applies to regions as it does to the arenas
+    RegionChunk* mapRegionChunk(size_t size, size_t alignment)
+    {
+        if (size > SIZE_MAX/4 || alignment > SIZE_MAX/4) return nullptr;
+        size_t length = alignUp(sizeof(RegionChunk)+size+alignment, ARENA_CHUNK_SIZE);
+        void* mem = mapHugePages(length);
+        if (!mem)
+        {
+            mem = sysMmap(length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS);
+            if (mem == MAP_FAILED) return nullptr;
+        }
+        growFootprint(counters.regionBytes, length);
+        auto* chunk = static_cast<RegionChunk*>(mem);
+        chunk->next = nullptr;
+        chunk->length = length;
+        return chunk;
+    }
+
+    void unmapRegionChunk(RegionChunk* chunk)
+    {
+        size_t length = chunk->length;
+        sysMunmap(chunk, length);
+        counters.regionBytes.fetch_sub(length, std::memory_order_relaxed);
+    }
+
+    // a fresh chunk becomes the top, the previous top is binned like any free blk
+    bool mapArenaChunk(HeapArena& arena)
+    {
+        evictCachedMappings(0);
+        void* mem = mapHugePages(ARENA_CHUNK_SIZE);
+        if (!mem) mem = mapAligned(ARENA_CHUNK_SIZE, ARENA_CHUNK_SIZE);
+        if (!mem) return false;
+        // before the header write faults in the first page
+        if (arena.node >= 0) sysMbind(mem, ARENA_CHUNK_SIZE, arena.node);
+        growFootprint(counters.chunkBytes, ARENA_CHUNK_SIZE);
+
+        auto* chunk = reinterpret_cast<ArenaChunk*>(mem);
+        chunk->arena = &arena;
+        if (arena.top) addToFreeList(arena, arena.top);
+
+        arena.top = initialiseBlock(static_cast<char*>(mem)+ARENA_CHUNK_HEADER_SIZE, ARENA_CHUNK_CAPACITY, FLAG_FREE | FLAG_NON_MAIN_ARENA);
+        initialiseBlock(getNextAdjacent(arena.top), 0, FLAG_NON_MAIN_ARENA);
+        updateBoundaryTag(arena.top);
+        arena.topCleanFrom = reinterpret_cast<char*>(arena.top+1);
+        return true;
+    }
+
+    // over-map, put the header right before the first aligned payload and trim the whole pages around it
+    // the blk gets the whole mapping past its header, so a reused mapping keeps its length when freed again;
+    // `reserved` bytes in front of the header stay mapped as well, they hold the record of a sampled blk
+    void* mapBlock(size_t alignment, size_t size, size_t& dirtyBytes, size_t reserved = 0)
+    {
+        size_t pageSize = getPageSize();
+        size_t slack = alignment > SIZE_GRANULE ? alignment : 0;
+        size_t length = (size+slack+reserved+sizeof(MmapBlock) + pageSize-1) & ~(pageSize-1);
+
+        std::uintptr_t base, payload;
+        if (CachedMapping* cached = takeCachedMapping(length))
+        {
+            base = reinterpret_cast<std::uintptr_t>(cached);
+            length = cached->length;
+            payload = (base + reserved+sizeof(MmapBlock) + alignment-1) & ~(alignment-1);
+            dirtyBytes = base+length-payload;
+        }
+        else if (void* huge = fitsHugePages(length, alignment) ? mapHugePages(alignUp(length, HUGE_PAGE_SIZE)) : nullptr)
+        {
+            base = reinterpret_cast<std::uintptr_t>(huge);
+            length = alignUp(length, HUGE_PAGE_SIZE);
+            payload = (base + reserved+sizeof(MmapBlock) + alignment-1) & ~(alignment-1);
+            dirtyBytes = 0;
+            growFootprint(counters.mappedBytes, length);
+        }
+        else
+        {
+            void* mem = sysMmap(length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS);
+            if (mem == MAP_FAILED) return nullptr;
+
+            // trim the over-mapped lead and tail to the pages the aligned payload needs
+            auto start = reinterpret_cast<std::uintptr_t>(mem);
+            payload = (start + reserved+sizeof(MmapBlock) + alignment-1) & ~(alignment-1);
+            base = (payload-sizeof(MmapBlock)-reserved) & ~(pageSize-1);
+            if (base > start) sysMunmap(mem, base-start);
+            auto end = (payload+size + pageSize-1) & ~(pageSize-1);
+            if (start+length > end) sysMunmap(reinterpret_cast<void*>(end), start+length-end);
+            length = end-base;
+            dirtyBytes = 0;
+            growFootprint(counters.mappedBytes, length);
+        }
+        counters.mmapBlocks.fetch_add(1, std::memory_order_relaxed);
+
+        auto* block = reinterpret_cast<MmapBlock*>(payload-sizeof(MmapBlock));
+        block->mappingOffset = payload-sizeof(MmapBlock)-base;
+        block->sizeAndFlags = sealHeader(block, (base+length-payload) | FLAG_MMAPPED);
+        return reinterpret_cast<void*>(block+1);
+    }
+
+    void* remapBlock(MmapBlock* block, size_t size)
+    {
+        size_t offset = block->mappingOffset;
+        char* mapping = reinterpret_cast<char*>(block)-offset;
+        size_t oldLength = offset+sizeof(MmapBlock)+(block->sizeAndFlags & SIZE_MASK);
+        size_t newLength = offset+sizeof(MmapBlock)+size;
+        void* mem = sysMremap(mapping, oldLength, newLength, MREMAP_MAYMOVE);
+        if (mem == MAP_FAILED) return nullptr;
+        counters.mappedBytes.fetch_sub(alignUp(oldLength, getPageSize()), std::memory_order_relaxed);
+        growFootprint(counters.mappedBytes, alignUp(newLength, getPageSize()));
+
+        // the header moved with the mapping
+        block = reinterpret_cast<MmapBlock*>(static_cast<char*>(mem)+offset);
+        block->sizeAndFlags = sealHeader(block, size | FLAG_MMAPPED);
+        return reinterpret_cast<void*>(block+1);
+    }
+
+    void unmapBlock(MmapBlock* block)
+    {
+        size_t pageSize = getPageSize();
+        size_t size = block->sizeAndFlags & SIZE_MASK;
+        size_t length = (block->mappingOffset+sizeof(MmapBlock)+size + pageSize-1) & ~(pageSize-1);
+        char* base = reinterpret_cast<char*>(block)-block->mappingOffset;
+        counters.mmapBlocks.fetch_sub(1, std::memory_order_relaxed);
+        if (length > mappingCacheLimit.load(std::memory_order_relaxed))
+        {
+            sysMunmap(base, length);
+            counters.mappedBytes.fetch_sub(length, std::memory_order_relaxed);
+            evictCachedMappings(0);
+            return;
+        }
+
+        auto* cached = reinterpret_cast<CachedMapping*>(base);
+        cached->length = length;
+        cached->releasedAt = std::chrono::steady_clock::now();
+        {
+            std::lock_guard<Mutex> lock(mappingCacheMutex);
+            cached->prevInClass = nullptr;
+            cached->nextInClass = cachedMappings[getBinIndex(length)];
+            if (cached->nextInClass) cached->nextInClass->prevInClass = cached;
+            cachedMappings[getBinIndex(length)] = cached;
+            cached->newer = nullptr;
+            cached->older = newestMapping;
+            if (newestMapping) newestMapping->newer = cached;
+            else oldestMapping = cached;
+            newestMapping = cached;
+            cachedMappingBytes += length;
+        }
+        evictCachedMappings(0);
+    }
+
+    // a cached mapping of at least `length` bytes, taken from the matching class or the one above
+    // so no more than about a third of it goes unused
+    CachedMapping* takeCachedMapping(size_t length)
+    {
+        evictCachedMappings(0);
+        std::lock_guard<Mutex> lock(mappingCacheMutex);
+        size_t first = getBinIndex(length);
+        for (size_t idx = first; idx < std::min(first+2, NUM_BINS); ++idx)
+        {
+            for (CachedMapping* curr = cachedMappings[idx]; curr; curr = curr->nextInClass)
+            {
+                if (curr->length < length || curr->length > 2*length) continue;
+                unlinkCachedMapping(curr);
+                return curr;
+            }
+        }
+        return nullptr;
+    }
+
+    // unmap mappings that expired or no longer fit the budget, plus up to `count` more, oldest first;
+    // the syscalls run after the lock is dropped
+    bool evictCachedMappings(size_t count)
+    {
+        CachedMapping* evicted = nullptr;
+        {
+            std::lock_guard<Mutex> lock(mappingCacheMutex);
+            auto expiry = std::chrono::steady_clock::now() - mappingCacheDecay.load(std::memory_order_relaxed);
+            size_t limit = mappingCacheLimit.load(std::memory_order_relaxed);
+            while (CachedMapping* oldest = oldestMapping)
+            {
+                if (!count && oldest->releasedAt > expiry && cachedMappingBytes <= limit) break;
+                if (count) --count;
+                unlinkCachedMapping(oldest);
+                oldest->nextInClass = evicted;
+                evicted = oldest;
+            }
+        }
+
+        bool released = evicted;
+        while (evicted)
+        {
+            CachedMapping* next = evicted->nextInClass;
+            counters.mappedBytes.fetch_sub(evicted->length, std::memory_order_relaxed);
+            sysMunmap(evicted, evicted->length);
+            evicted = next;
+        }
+        return released;
+    }
+
+    void unlinkCachedMapping(CachedMapping* cached)
+    {
+        if (cached->prevInClass) cached->prevInClass->nextInClass = cached->nextInClass;
+        else cachedMappings[getBinIndex(cached->length)] = cached->nextInClass;
+        if (cached->nextInClass) cached->nextInClass->prevInClass = cached->prevInClass;
+        if (cached->newer) cached->newer->older = cached->older;
+        else newestMapping = cached->older;
+        if (cached->older) cached->older->newer = cached->newer;
+        else oldestMapping = cached->newer;
+        cachedMappingBytes -= cached->length;
+    }
+
+    // every syscall of the allocator goes through these so the stats can count them
+    void* sysMmap(size_t length, int prot, int flags)
+    {
+        countSyscall(counters.mmapCalls);
+        return mmap(nullptr, length, prot, flags, -1, 0);
+    }
+
+    int sysMunmap(void* addr, size_t length)
+    {
+        countSyscall(counters.munmapCalls);
+        return munmap(addr, length);
+    }
+
+    // a preferred node rather than a strict binding, so a full node spills over instead of failing the fault;
+    // the mask covers nodes 0 to 63, placement on any higher one is left to the kernel
+    void sysMbind(void* addr, size_t length, int node)
+    {
+        if (node >= static_cast<int>(MAX_NUMA_NODES)) return;
+        unsigned long mask = 1UL << node;
+        countSyscall(counters.mbindCalls);
+        syscall(SYS_mbind, addr, length, MPOL_PREFERRED, &mask, sizeof(mask)*8+1, 0);
+    }
+
+    // ids of the online nodes listed in sysfs, e.g. "0-1,4" gives 0, 1 and 4; read without allocating, and
+    // ids past the mbind mask are left out; 0 if the list can't be read
+    static size_t readOnlineNumaNodes(int (&ids)[MAX_NUMA_NODES])
+    {
+        int fd = open("/sys/devices/system/node/online", O_RDONLY | O_CLOEXEC);
+        if (fd < 0) return 0;
+        char text[256];
+        ssize_t length = read(fd, text, sizeof(text)-1);
+        close(fd);
+        if (length <= 0) return 0;
+        size_t count = 0, first = 0, number = 0;
+        bool inRange = false, hasDigits = false;
+        for (ssize_t i = 0; i <= length; ++i)
+        {
+            char c = i < length ? text[i] : '\n';
+            if (c >= '0' && c <= '9')
+            {
+                number = number*10 + static_cast<size_t>(c-'0');
+                hasDigits = true;
+            }
+            else if (c == '-')
+            {
+                first = number;
+                number = 0;
+                inRange = true;
+            }
+            else
+            {
+                for (size_t id = inRange ? first : number; hasDigits && id <= number && id < MAX_NUMA_NODES && count < MAX_NUMA_NODES; ++id)
+                {
+                    ids[count++] = static_cast<int>(id);
+                }
+                number = first = 0;
+                inRange = hasDigits = false;
+            }
+        }
+        return count;
+    }
+
+    void* sysMremap(void* addr, size_t oldLength, size_t newLength, int flags)
+    {
+        countSyscall(counters.mremapCalls);
+        return mremap(addr, oldLength, newLength, flags);
+    }
+
+    int sysMadvise(void* addr, size_t length, int advice)
+    {
+        countSyscall(counters.madviseCalls);
+        return madvise(addr, length, advice);
+    }
+
+    int sysMprotect(void* addr, size_t length, int prot)
+    {
+        countSyscall(counters.mprotectCalls);
+        return mprotect(addr, length, prot);
+    }
+
+    // sbrk(0) only reads the cached break, so just the moves are counted
+    void* sysSbrk(std::intptr_t increment)
+    {
+        countSyscall(counters.sbrkCalls);
+        return sbrk(increment);
+    }
+
+    // raise one of the footprint counters and the peak with it
+    void growFootprint(std::atomic<size_t>& counter, size_t bytes)
+    {
+        counter.fetch_add(bytes, std::memory_order_relaxed);
+        size_t footprint = counters.footprint();
+        size_t peak = counters.peakBytes.load(std::memory_order_relaxed);
+        while (peak < footprint && !counters.peakBytes.compare_exchange_weak(peak, footprint, std::memory_order_relaxed)) {}
+    }
+
+    static size_t getPageSize()
+    {
+        static const size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+        return pageSize;
+    }
+
+    // over-map and trim so the mapping starts on an `alignment` boundary
+    void* mapAligned(size_t size, size_t alignment)
+    {
+        size_t mappedSize = size+alignment;
+        void* mem = sysMmap(mappedSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS);
+        if (mem == MAP_FAILED) return nullptr;
+
+        auto start = reinterpret_cast<std::uintptr_t>(mem);
+        auto alignedStart = (start + alignment-1) & ~(alignment-1);
+        if (alignedStart > start) sysMunmap(mem, alignedStart-start);
+        size_t tail = start+mappedSize - (alignedStart+size);
+        if (tail) sysMunmap(reinterpret_cast<void*>(alignedStart+size), tail);
+        return reinterpret_cast<void*>(alignedStart);
+    }
+
+    bool fitsHugePages(size_t length, size_t alignment) const
+    {
+        return alignment <= HUGE_PAGE_SIZE && alignUp(length, HUGE_PAGE_SIZE)-length <= hugePageSlack.load(std::memory_order_relaxed);
+    }
+
+    // a HUGE_PAGE_SIZE aligned mapping of `length`, a multiple of it; nullptr when huge pages are off
+    void* mapHugePages(size_t length)
+    {
+        HugePages mode = hugePages.load(std::memory_order_relaxed);
+        if (mode == HugePages::Off) return nullptr;
+        if (mode == HugePages::HugeTlb)
+        {
+            constexpr int hugeFlags = MAP_HUGETLB | (std::countr_zero(HUGE_PAGE_SIZE) << MAP_HUGE_SHIFT);
+            void* mem = sysMmap(length, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS|hugeFlags);
+            if (mem != MAP_FAILED) return mem;
+        }
+
+        void* mem = mapAligned(length, HUGE_PAGE_SIZE);
+        if (mem) sysMadvise(mem, length, MADV_HUGEPAGE);
+        return mem;
+    }
+
+    static constexpr size_t alignUp(size_t size, size_t alignment)
+    {
+        return (size + alignment-1) & ~(alignment-1);
+    }
+
+    static MemoryBlock* initialiseBlock(void* mem, size_t size, size_t flags)
+    {
+        auto* block = reinterpret_cast<MemoryBlock*>(mem);
+        block->prevSize = 0;
+        block->sizeAndFlags = sealHeader(block, size | flags);
+        return block;
+    }
+
+    static FreeLinks* getFreeLinks(MemoryBlock* block)
+    {
+        return reinterpret_cast<FreeLinks*>(block+1);
+    }
+
+    // physical successor, the fencepost when `block` is the last one of its segment
+    static MemoryBlock* getNextAdjacent(MemoryBlock* block)
+    {
+        return reinterpret_cast<MemoryBlock*>(reinterpret_cast<char*>(block+1) + block->size());
+    }
+
+    // physical predecessor read from the boundary tag, only known while it is free
+    static MemoryBlock* getPrevFreeAdjacent(MemoryBlock* block)
+    {
+        if (!block->hasFlag(FLAG_PREV_FREE)) return nullptr;
+        return reinterpret_cast<MemoryBlock*>(reinterpret_cast<char*>(block) - block->prevSize - sizeof(MemoryBlock));
+    }
+
+    // publish the state and size of `block` to the blk right after it
+    static void updateBoundaryTag(MemoryBlock* block)
+    {
+        MemoryBlock* next = getNextAdjacent(block);
+        next->setFlag(FLAG_PREV_FREE, block->hasFlag(FLAG_FREE));
+        next->prevSize = block->size();
+    }
+
+    static size_t alignSize(size_t size)
+    {
+        return (size + SIZE_GRANULE-1) & ~(SIZE_GRANULE-1);
+    }
+
+    static size_t getBinIndex(size_t size)
+    {
+        const BinRow& row = BIN_ROWS[std::bit_width(size)];
+        return row.base + ((size >> row.shift) & row.mask);
+    }
+
+    // inverse of getBinIndex(), the smallest size that maps to `idx`
+    static size_t getBinMinSize(size_t idx)
+    {
+        if (idx < NUM_SMALL_BINS) return idx*SIZE_GRANULE;
+        size_t log2 = SMALL_BIN_LIMIT_LOG2 + (idx-NUM_SMALL_BINS)/LARGE_BINS_PER_POW2;
+        return (1ULL << log2) + (idx-NUM_SMALL_BINS)%LARGE_BINS_PER_POW2 * (1ULL << (log2-LARGE_BINS_LOG2));
+    }
+
+    // first non-empty bin at or after `from`, NUM_BINS if there is none
+    static size_t findNonEmptyBin(const HeapArena& arena, size_t from)
+    {
+        for (size_t word = from/64; word < BIN_MAP_WORDS; ++word)
+        {
+            uint64_t bits = arena.binMap[word];
+            if (word == from/64) bits &= ~0ULL << (from%64);
+            if (bits) return word*64 + std::countr_zero(bits);
+        }
+        return NUM_BINS;
+    }
+
+    static void addToFreeList(HeapArena& arena, MemoryBlock* block)
+    {
+        size_t idx = getBinIndex(block->size());
+        if (isTreeBin(idx)) return addToTree(arena, block, idx);
+        FreeLinks* links = getFreeLinks(block);
+        links->prevFree = nullptr;
+        links->nextFree = arena.freeBins[idx];
+        if constexpr (std::is_same_v<PlacementPolicy, Placement::AddressOrderedFirstFit>)
+        {
+            while (links->nextFree && links->nextFree < block)
+            {
+                links->prevFree = links->nextFree;
+                links->nextFree = getFreeLinks(links->nextFree)->nextFree;
+            }
+        }
+        if (links->nextFree) getFreeLinks(links->nextFree)->prevFree = block;
+        if (links->prevFree) getFreeLinks(links->prevFree)->nextFree = block;
+        else arena.freeBins[idx] = block;
+        arena.binMap[idx/64] |= 1ULL << (idx%64);
+    }
+
+    static void removeFromFreeList(HeapArena& arena, MemoryBlock* block)
+    {
+        size_t idx = getBinIndex(block->size());
+        if (isTreeBin(idx)) return removeFromTree(arena, block, idx);
+        FreeLinks* links = getFreeLinks(block);
+        if constexpr (HARDENED)
+        {
+            // both neighbours must point back at the blk, or an overwritten link would aim the unlink anywhere
+            MemoryBlock* fromPrev = links->prevFree ? getFreeLinks(links->prevFree)->nextFree : arena.freeBins[idx];
+            if (fromPrev != block || (links->nextFree && getFreeLinks(links->nextFree)->prevFree != block))
+            {
+                reportMisuse("corrupted free list");
+            }
+        }
+        if (links->prevFree) getFreeLinks(links->prevFree)->nextFree = links->nextFree;
+        else arena.freeBins[idx] = links->nextFree;
+        if (links->nextFree) getFreeLinks(links->nextFree)->prevFree = links->prevFree;
+        if (block == arena.rover) arena.rover = links->nextFree;
+
+        if (!arena.freeBins[idx]) arena.binMap[idx/64] &= ~(1ULL << (idx%64));
+    }
+
+    // small bins hold a single size so their head always fits; ranged bins are searched according to the policy
+    static MemoryBlock* findFreeBloc(HeapArena& arena, size_t size)
+    {
+        size_t idx = getBinIndex(size);
+        if constexpr (USE_TREE_BINS)
+        {
+            if (!isTreeBin(idx) && arena.freeBins[idx]) return arena.freeBins[idx];
+            if (isTreeBin(idx))
+            {
+                if (MemoryBlock* best = findInTree(arena.freeBins[idx], idx, size)) return best;
+            }
+
+            // bins only grow in size, so the smallest blk of the next non-empty one is the best overall
+            size_t next = findNonEmptyBin(arena, idx+1);
+            if (next == NUM_BINS) return nullptr;
+            return isTreeBin(next) ? findInTree(arena.freeBins[next], next, 0) : arena.freeBins[next];
+        }
+        else if constexpr (std::is_same_v<PlacementPolicy, Placement::NextFit>)
+        {
+            MemoryBlock* start = arena.rover && getBinIndex(arena.rover->size()) == idx ? arena.rover : arena.freeBins[idx];
+            for (MemoryBlock* curr = start; curr; curr = getFreeLinks(curr)->nextFree)
+            {
+                if (curr->size() >= size) return arena.rover = curr;
+            }
+            for (MemoryBlock* curr = arena.freeBins[idx]; curr != start; curr = getFreeLinks(curr)->nextFree)
+            {
+                if (curr->size() >= size) return arena.rover = curr;
+            }
+        }
+        else
+        {
+            for (MemoryBlock* curr = arena.freeBins[idx]; curr; curr = getFreeLinks(curr)->nextFree)
+            {
+                if (curr->size() >= size) return curr;
+            }
+        }
+
+        // every block in a higher bin is large enough
+        size_t next = findNonEmptyBin(arena, idx+1);
+        return next < NUM_BINS ? arena.freeBins[next] : nullptr;
+    }
+
+    static bool isTreeBin(size_t idx)
+    {
+        return USE_TREE_BINS && idx >= NUM_SMALL_BINS;
+    }
+
+    static TreeLinks* getTreeLinks(MemoryBlock* block)
+    {
+        return reinterpret_cast<TreeLinks*>(block+1);
+    }
+
+    // highest size bit that varies between the blks of large bin `idx`, the first one its trie branches on;
+    // the last bin also takes every larger size, so it branches on all the bits
+    static size_t getTreeShift(size_t idx)
+    {
+        if (idx == NUM_BINS-1) return 63;
+        size_t log2 = SMALL_BIN_LIMIT_LOG2 + (idx-NUM_SMALL_BINS)/LARGE_BINS_PER_POW2;
+        return log2 - std::bit_width(LARGE_BINS_PER_POW2);
+    }
+
+    static void addToTree(HeapArena& arena, MemoryBlock* block, size_t idx)
+    {
+        TreeLinks* links = getTreeLinks(block);
+        links->list = {nullptr, nullptr};
+        links->child[0] = links->child[1] = nullptr;
+        links->parent = nullptr;
+        links->inTree = true;
+
+        MemoryBlock* curr = arena.freeBins[idx];
+        if (!curr)
+        {
+            arena.freeBins[idx] = block;
+            arena.binMap[idx/64] |= 1ULL << (idx%64);
+            return;
+        }
+
+        size_t size = block->size();
+        size_t bits = size << (63-getTreeShift(idx));
+        while (curr->size() != size)
+        {
+            MemoryBlock*& child = getTreeLinks(curr)->child[bits >> 63];
+            bits <<= 1;
+            if (!child)
+            {
+                child = block;
+                links->parent = curr;
+                return;
+            }
+            curr = child;
+        }
+
+        // queue right behind the node of the same size
+        FreeLinks& node = getTreeLinks(curr)->list;
+        links->inTree = false;
+        links->list.prevFree = curr;
+        links->list.nextFree = node.nextFree;
+        if (node.nextFree) getFreeLinks(node.nextFree)->prevFree = block;
+        node.nextFree = block;
+    }
+
+    static void removeFromTree(HeapArena& arena, MemoryBlock* block, size_t idx)
+    {
+        TreeLinks* links = getTreeLinks(block);
+        if (!links->inTree)
+        {
+            getFreeLinks(links->list.prevFree)->nextFree = links->list.nextFree;
+            if (links->list.nextFree) getFreeLinks(links->list.nextFree)->prevFree = links->list.prevFree;
+            return;
+        }
+
+        // the next blk of the same size takes over the node, otherwise any leaf below it does
+        MemoryBlock* replacement = links->list.nextFree;
+        if (!replacement)
+        {
+            MemoryBlock** slot = links->child[1] ? &links->child[1] : &links->child[0];
+            while (*slot)
+            {
+                TreeLinks* leaf = getTreeLinks(*slot);
+                if (!leaf->child[0] && !leaf->child[1]) break;
+                slot = leaf->child[1] ? &leaf->child[1] : &leaf->child[0];
+            }
+            replacement = *slot;
+            *slot = nullptr;
+        }
+
+        MemoryBlock* parent = links->parent;
+        if (!parent) arena.freeBins[idx] = replacement;
+        else getTreeLinks(parent)->child[getTreeLinks(parent)->child[1] == block] = replacement;
+        if (!arena.freeBins[idx]) arena.binMap[idx/64] &= ~(1ULL << (idx%64));
+        if (!replacement) return;
+
+        TreeLinks* replacementLinks = getTreeLinks(replacement);
+        replacementLinks->list.prevFree = nullptr;
+        replacementLinks->inTree = true;
+        replacementLinks->parent = parent;
+        for (size_t i = 0; i < 2; ++i)
+        {
+            replacementLinks->child[i] = links->child[i];
+            if (links->child[i]) getTreeLinks(links->child[i])->parent = replacement;
+        }
+    }
+
+    // smallest blk of at least `size` in the trie at `root`, after dlmalloc's tmalloc_large: one walk down the
+    // path of `size` remembers the deepest subtree of larger sizes it stepped past, whose minimum is on its
+    // leftmost path
+    static MemoryBlock* findInTree(MemoryBlock* root, size_t idx, size_t size)
+    {
+        MemoryBlock* best = nullptr;
+        MemoryBlock* larger = nullptr;
+        size_t bits = size << (63-getTreeShift(idx));
+        for (MemoryBlock* curr = root; curr; bits <<= 1)
+        {
+            if (curr->size() >= size && (!best || curr->size() < best->size()))
+            {
+                best = curr;
+                if (curr->size() == size) return best;
+            }
+            MemoryBlock* right = getTreeLinks(curr)->child[1];
+            curr = getTreeLinks(curr)->child[bits >> 63];
+            if (right && right != curr) larger = right;
+        }
+
+        for (MemoryBlock* curr = larger; curr; )
+        {
+            if (!best || curr->size() < best->size()) best = curr;
+            TreeLinks* links = getTreeLinks(curr);
+            curr = links->child[0] ? links->child[0] : links->child[1];
+        }
+        return best;
+    }
+
+    // visits every blk binned under `head` without changing the bin
+    template <typename Fn>
+    static void forEachFreeBlock(MemoryBlock* head, bool isTree, Fn&& fn)
+    {
+        for (MemoryBlock* curr = head; curr; curr = getFreeLinks(curr)->nextFree)
+        {
+            fn(curr);
+        }
+        if (!isTree || !head) return;
+        for (MemoryBlock* child : getTreeLinks(head)->child)
+        {
+            forEachFreeBlock(child, true, fn);
+        }
+    }
+
+    bool shouldSplitBlock(MemoryBlock* block, size_t size)
+    {
+        return block->size() >= size+MIN_USEABLE_SIZE;
+    }
+
+    // `block` is in use; the remainder after `size` bytes becomes a free blk
+    void splitBlock(HeapArena& arena, MemoryBlock* block, size_t size)
+    {
+        auto* payloadStart = reinterpret_cast<char*>(block+1);
+        size_t remainder = block->size() - size - sizeof(MemoryBlock);
+        MemoryBlock* newBlock = initialiseBlock(payloadStart+size, remainder, FLAG_FREE | (block->load() & FLAG_NON_MAIN_ARENA));
+        block->setSize(size);
+        addToFreeList(arena, newBlock);
+        updateBoundaryTag(newBlock);
+        countEvent(arena.splits);
+    }
+
+    // merge with the physical neighbours only; the boundary tags make both lookups O(1)
+    MemoryBlock* coalesce(HeapArena& arena, MemoryBlock* block)
+    {
+        MemoryBlock* next = getNextAdjacent(block);
+        checkHeader(next);
+        if (next->hasFlag(FLAG_FREE))
+        {
+            // a blk merging into the top becomes the top, which is never binned
+            if (next == arena.top) arena.top = block;
+            else removeFromFreeList(arena, next);
+            // just to maintain correctness of block metadata, the memory is already allocated
+            block->setSize(block->size()+sizeof(MemoryBlock)+next->size());
+            countEvent(arena.merges);
+        }
+
+        MemoryBlock* prev = getPrevFreeAdjacent(block);
+        if (prev)
+        {
+            checkHeader(prev);
+            removeFromFreeList(arena, prev);
+            prev->setSize(prev->size()+sizeof(MemoryBlock)+block->size());
+            if (block == arena.top) arena.top = prev;
+            block = prev;
+            countEvent(arena.merges);
+        }
+        return block;
+    }
+};
+
+template <typename PlacementPolicy, typename Config>
+thread_local typename SbrkMemoryAllocator<PlacementPolicy, Config>::ThreadCache SbrkMemoryAllocator<PlacementPolicy, Config>::threadCache;
@@ -1,186 +1,7 @@
+#include <algorithm>
 #include <iostream>
-#include <unistd.h>
-#include <sys/mman.h>
-
-// todo: use a diff struct for memory allocated via mmap to avoid unncessary fields
-
-class SbrkMemoryAllocator
-{
-private:
-    struct MemoryBlock
-    {
-        size_t size;
-        bool isFree;
-        bool isMmapAllocated;
-        MemoryBlock* next; // next blk
-        MemoryBlock* nextFree; // next blk in free list
-    };
-
-    constexpr static size_t MIN_PAYLOAD_SIZE = 8;
-    constexpr static size_t MIN_USEABLE_SIZE = sizeof(MemoryBlock)+MIN_PAYLOAD_SIZE;
-
-    constexpr static size_t MMAP_THRESHOLD = 128*1024; // 128KB
-
-    MemoryBlock* freeListHead = nullptr; // only free blocks
-    MemoryBlock* blockListHead = nullptr; // all blocks
-
-
-public:
-    void* malloc(size_t size)
-    {
-        if (size >= MMAP_THRESHOLD)
-        {
-            size_t totalSize = size+sizeof(MemoryBlock);
-            void* mem = mmap(nullptr, totalSize, PROT_READ|PROT_WRITE, MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
-            if (mem == MAP_FAILED) return nullptr;
-            MemoryBlock* block = initialiseBlock(mem, size, true);
-            return reinterpret_cast<void*>(block+1);
-        }
-
-        MemoryBlock* freeBlock = findFreeBloc(size);
-        if (freeBlock)
-        {
-            if (shouldSplitBlock(freeBlock, size)) splitBlock(freeBlock, size);
-            freeBlock->isFree = false;
-            removeFromFreeList(freeBlock);
-            // user should not have access to metadata of the memory block; possible overwriting metadata
-            return reinterpret_cast<void*>(freeBlock+1);
-        }
-
-        void* mem = sbrk(size+sizeof(MemoryBlock));
-        if (mem == reinterpret_cast<void*>(static_cast<std::intptr_t>(-1))) return nullptr;
-
-        MemoryBlock* block = initialiseBlock(mem, size, false);
-        appendToBlockList(block);
-
-        return reinterpret_cast<void*>(block+1);
-    }
-
-    void free(void* ptr)
-    {
-        if (!ptr) return;
-        auto* block = reinterpret_cast<MemoryBlock*>(static_cast<char*>(ptr) - sizeof(MemoryBlock));
-
-        if (block->isMmapAllocated)
-        {
-            munmap(block, block->size + sizeof(MemoryBlock));
-            return;
-        }
-        block->isFree = true;
-        addToFreeList(block);
-        mergeContigousFreeBlocks();
-    }
-
-private:
-    MemoryBlock* initialiseBlock(void* mem, size_t size, bool isMmapAllocated)
-    {
-        auto* block = reinterpret_cast<MemoryBlock*>(mem);
-        block->size = size;
-        block->isFree = false;
-        block->isMmapAllocated = isMmapAllocated;
-        block->next = nullptr;
-        block->nextFree = nullptr;
-        return block;
-    }
-    void appendToBlockList(MemoryBlock* block)
-    {
-        if (!blockListHead)
-        {
-            blockListHead = block;
-            return;
-        }
-        MemoryBlock* curr = blockListHead;
-        while (curr->next)
-        {
-            curr = curr->next;
-        }
-        curr->next = block;
-    }
-
-    void addToFreeList(MemoryBlock* block)
-    {
-        block->nextFree = freeListHead;
-        freeListHead = block;
-    }
-
-    void removeFromFreeList(MemoryBlock* block)
-    {
-        if (!freeListHead) return;
-
-        if (freeListHead == block)
-        {
-            freeListHead = freeListHead->next;
-            return;
-        }
-
-        MemoryBlock* curr = freeListHead;
-        while (curr->nextFree && curr->nextFree != block)
-        {
-            curr = curr->nextFree;
-        }
-
-        if (curr->nextFree == block)
-        {
-            curr->nextFree = block->nextFree;
-        }
-    }
-
-    // first fit algorithm
-    MemoryBlock* findFreeBloc(size_t size)
-    {
-        MemoryBlock* curr = freeListHead;
-        while (curr)
-        {
-            if (curr->isFree && curr->size >= size) return curr;
-            curr = curr->nextFree;
-        }
-        return nullptr;
-    }
-
-    bool shouldSplitBlock(MemoryBlock* block, size_t size)
-    {
-        return block->size >= size+MIN_USEABLE_SIZE;
-    }
-
-    void splitBlock(MemoryBlock* block, size_t size)
-    {
-        auto* payloadStart = reinterpret_cast<char*>(block+1);
-        auto* newBlock = reinterpret_cast<MemoryBlock*>(payloadStart+size);
-
-        newBlock->size = block->size - size - sizeof(MemoryBlock);
-        newBlock->isFree = true;
-        newBlock->next = block->next;
-        addToFreeList(newBlock);
-
-        block->size = size;
-        block->next = newBlock;
-    }
-
-    void mergeContigousFreeBlocks()
-    {
-        MemoryBlock* curr = blockListHead;
-        while (curr && curr->nextFree)
-        {
-            MemoryBlock* next = curr->nextFree;
-            if (curr->isFree && next->isFree)
-            {
-                // ensure that both blocks are contigous. note: bound is not inclusive
-                auto* currBlockBound = reinterpret_cast<char*>(curr+1) + curr->size;
-                if (currBlockBound == reinterpret_cast<char*>(next))
-                {
-                    // just to maintain correctness of block metadata, the memory is already allocated
-                    curr->size += sizeof(MemoryBlock)+next->size;
-                    curr->next = next->next;
-                    removeFromFreeList(next);
-                    continue;
-                }
-            curr = curr->next;
-            }
-        }
-    }
-};
-
-
+#include <vector>
+#include "SbrkMemoryAllocator.h"
 
 int main()
 {
@@ -193,10 +14,51 @@ int main()
     char* buffer2 = static_cast<char*>(allocator.malloc(32));
     memcpy(buffer2, "Test2!", 7);
     std::cout << "Buffer2: " << buffer2 << std::endl;
-
-    // we should still see some of original buffer since we did not overwrite most of it, simply freed
-    std::cout << "Buffer: " << buffer+12 << std::endl;
-
+    allocator.free(buffer2);
+
+    // blocks carved from a trimmed top must still come back zeroed from calloc
+    constexpr size_t TRIM_BLOCK = 1024;
+    std::vector<void*> blocks;
+    for (int i = 0; i < 2016; ++i) {
+        blocks.push_back(allocator.malloc(TRIM_BLOCK));
+        memset(blocks.back(), 0xab, TRIM_BLOCK);
+    }
+    for (void* block : blocks) allocator.free(block);
+    blocks.clear();
+    allocator.malloc_trim(0);
+    size_t dirtyBlocks = 0;
+    for (int i = 0; i < 2016; ++i) {
+        auto* block = static_cast<char*>(allocator.calloc(1, TRIM_BLOCK));
+        if (std::any_of(block, block+TRIM_BLOCK, [](char c) { return c != 0; })) ++dirtyBlocks;
+        blocks.push_back(block);
+    }
+    for (void* block : blocks) allocator.free(block);
+    std::cout << "calloc after malloc_trim: " << dirtyBlocks << " dirty blocks" << std::endl;
+    if (dirtyBlocks) return 1;
+
+    // runs of a slab class freed in full go back to the kernel and leave the footprint
+    constexpr size_t SLAB_OBJECT = 64;
+    blocks.clear();
+    size_t slabBefore = allocator.getStats().slabBytes;
+    for (int i = 0; i < 20000; ++i) {
+        blocks.push_back(allocator.malloc(SLAB_OBJECT));
+        memset(blocks.back(), 0xab, SLAB_OBJECT);
+    }
+    size_t slabFull = allocator.getStats().slabBytes;
+    for (void* block : blocks) allocator.free(block);
+    allocator.flushThreadCache();
+    size_t slabAfter = allocator.getStats().slabBytes;
+    size_t pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t residentPages = 0;
+    for (size_t i = 0; i < blocks.size(); i += pageSize/SLAB_OBJECT) {
+        auto page = reinterpret_cast<std::uintptr_t>(blocks[i]) & ~(pageSize-1);
+        unsigned char resident = 0;
+        if (mincore(reinterpret_cast<void*>(page), pageSize, &resident) == 0 && (resident & 1)) ++residentPages;
+    }
+    blocks.clear();
+    std::cout << "slab bytes: " << slabBefore << " before, " << slabFull << " full, " << slabAfter
+              << " freed, " << residentPages << " pages still resident" << std::endl;
+    if (slabAfter >= slabFull || residentPages > 4) return 1;
 
     constexpr size_t LARGE_ALLOC = 512 * 1024;  // 512 KB, triggers mmap
     char* bigBuffer = static_cast<char*>(allocator.malloc(LARGE_ALLOC));
@@ -0,0 +1,510 @@
+// allocator benchmarks against whatever malloc the process links, so one binary compares allocators via
+// LD_PRELOAD, e.g. LD_PRELOAD=./libsbrkmalloc.so ./malloc_bench larson
+#include <algorithm>
+#include <atomic>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include "AllocationTrace.h"
+
+namespace
+{
+    struct Options
+    {
+        size_t threads = std::max(2u, std::thread::hardware_concurrency());
+        double seconds = 2.0; // per multithreaded run
+        double scale = 1.0; // multiplies the op counts of the single threaded runs
+    };
+
+    uint64_t nowNanos()
+    {
+        return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    size_t residentBytes()
+    {
+        long pages = 0, resident = 0;
+        if (FILE* statm = fopen("/proc/self/statm", "r"))
+        {
+            if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) resident = 0;
+            fclose(statm);
+        }
+        return static_cast<size_t>(resident) * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    }
+
+    size_t peakResidentBytes()
+    {
+        rusage usage{};
+        getrusage(RUSAGE_SELF, &usage);
+        return static_cast<size_t>(usage.ru_maxrss) * 1024;
+    }
+
+    // keeps the compiler from dropping allocations whose memory is never read
+    void touch(void* ptr, size_t size)
+    {
+        if (!ptr || !size) return;
+        auto* bytes = static_cast<volatile char*>(ptr);
+        bytes[0] = 1;
+        bytes[size-1] = 1;
+    }
+
+    // log-linear buckets, 8 per power of two, in nanoseconds; the clock read is part of every sample
+    class LatencyHistogram
+    {
+    public:
+        void record(uint64_t nanos)
+        {
+            ++counts[getBucket(nanos)];
+            ++total;
+            maxNanos = std::max(maxNanos, nanos);
+        }
+
+        uint64_t percentile(double fraction) const
+        {
+            auto wanted = static_cast<uint64_t>(fraction * static_cast<double>(total));
+            uint64_t seen = 0;
+            for (size_t idx = 0; idx < NUM_BUCKETS; ++idx)
+            {
+                seen += counts[idx];
+                if (seen > wanted) return std::min(getBucketStart(idx+1), maxNanos);
+            }
+            return maxNanos;
+        }
+
+        void print(const char* name) const
+        {
+            if (!total) return;
+            printf("  %-8s p50 %6llu  p90 %6llu  p99 %6llu  p99.9 %7llu  max %9llu ns\n", name,
+                   static_cast<unsigned long long>(percentile(0.5)), static_cast<unsigned long long>(percentile(0.9)),
+                   static_cast<unsigned long long>(percentile(0.99)), static_cast<unsigned long long>(percentile(0.999)),
+                   static_cast<unsigned long long>(maxNanos));
+        }
+
+    private:
+        constexpr static size_t SUB_BUCKETS = 8;
+        constexpr static size_t NUM_BUCKETS = 62*SUB_BUCKETS;
+
+        static size_t getBucket(uint64_t value)
+        {
+            if (value < SUB_BUCKETS) return value;
+            size_t log2 = std::bit_width(value)-1;
+            size_t sub = (value >> (log2-3)) & (SUB_BUCKETS-1);
+            return std::min((log2-2)*SUB_BUCKETS + sub, NUM_BUCKETS-1);
+        }
+
+        static uint64_t getBucketStart(size_t idx)
+        {
+            if (idx < SUB_BUCKETS) return idx;
+            size_t log2 = idx/SUB_BUCKETS + 2;
+            return (SUB_BUCKETS + idx%SUB_BUCKETS) << (log2-3);
+        }
+
+        uint64_t counts[NUM_BUCKETS] = {};
+        uint64_t total = 0;
+        uint64_t maxNanos = 0;
+    };
+
+    // request sizes for the latency runs
+    struct SizeDistribution
+    {
+        const char* name;
+        size_t ops; // before scaling, fewer for the sizes that hit mmap
+        size_t (*draw)(std::mt19937_64& rng);
+    };
+
+    size_t drawLogUniform(std::mt19937_64& rng, size_t min, size_t max)
+    {
+        double exponent = std::uniform_real_distribution<double>(std::log2(min), std::log2(max))(rng);
+        return static_cast<size_t>(std::exp2(exponent));
+    }
+
+    const SizeDistribution SIZE_DISTRIBUTIONS[] = {
+        {"tiny", 2000000, [](std::mt19937_64& rng) { return size_t{8} + rng()%57; }}, // 8..64B
+        {"small", 2000000, [](std::mt19937_64& rng) { return size_t{16} + rng()%497; }}, // 16..512B
+        // mostly small with a tail of buffers, roughly what a service heap sees
+        {"mixed", 1000000, [](std::mt19937_64& rng)
+        {
+            size_t roll = rng()%100;
+            if (roll < 80) return drawLogUniform(rng, 16, 256);
+            if (roll < 97) return drawLogUniform(rng, 256, 8192);
+            return drawLogUniform(rng, 8192, 256*1024);
+        }},
+        {"large", 100000, [](std::mt19937_64& rng) { return drawLogUniform(rng, 64*1024, 4*1024*1024); }},
+    };
+
+    // replace random members of a live set, timing each free and malloc on its own
+    void runLatency(const Options& options)
+    {
+        constexpr size_t LIVE_OBJECTS = 4096;
+        for (const SizeDistribution& distribution : SIZE_DISTRIBUTIONS)
+        {
+            std::mt19937_64 rng(42);
+            std::vector<void*> live(LIVE_OBJECTS, nullptr);
+            LatencyHistogram mallocLatency, freeLatency;
+            auto ops = static_cast<size_t>(static_cast<double>(distribution.ops) * options.scale);
+
+            uint64_t start = nowNanos();
+            for (size_t i = 0; i < ops; ++i)
+            {
+                size_t slot = rng()%LIVE_OBJECTS;
+                size_t size = distribution.draw(rng);
+                if (live[slot])
+                {
+                    uint64_t before = nowNanos();
+                    free(live[slot]);
+                    freeLatency.record(nowNanos()-before);
+                }
+                uint64_t before = nowNanos();
+                live[slot] = malloc(size);
+                mallocLatency.record(nowNanos()-before);
+                touch(live[slot], size);
+            }
+            double elapsed = static_cast<double>(nowNanos()-start) / 1e9;
+            for (void* ptr : live) free(ptr);
+
+            printf("latency/%s: %.2f Mops/s incl. timing, peak rss %zu KB\n", distribution.name,
+                   2*static_cast<double>(ops) / elapsed / 1e6, peakResidentBytes()/1024);
+            mallocLatency.print("malloc");
+            freeLatency.print("free");
+        }
+    }
+
+    template <typename Fn>
+    double runThreads(size_t count, Fn&& fn)
+    {
+        std::vector<std::thread> threads;
+        uint64_t start = nowNanos();
+        for (size_t i = 0; i < count; ++i) threads.emplace_back(fn, i);
+        for (std::thread& thread : threads) thread.join();
+        return static_cast<double>(nowNanos()-start) / 1e9;
+    }
+
+    // larson: threads replace random slots of their own array, and every round hands the arrays to a fresh
+    // set of threads, so most frees hit blks another (now gone) thread allocated
+    void runLarson(const Options& options)
+    {
+        constexpr size_t SLOTS = 1000;
+        constexpr size_t ROUNDS = 10;
+        std::vector<std::vector<void*>> arrays(options.threads, std::vector<void*>(SLOTS, nullptr));
+        std::atomic<uint64_t> ops{0};
+        auto roundNanos = static_cast<uint64_t>(options.seconds / ROUNDS * 1e9);
+
+        double elapsed = 0;
+        for (size_t round = 0; round < ROUNDS; ++round)
+        {
+            elapsed += runThreads(options.threads, [&](size_t id)
+            {
+                std::mt19937_64 rng(round*options.threads + id);
+                std::vector<void*>& slots = arrays[(id+round) % options.threads];
+                uint64_t deadline = nowNanos()+roundNanos;
+                uint64_t count = 0;
+                while (nowNanos() < deadline)
+                {
+                    for (int i = 0; i < 64; ++i)
+                    {
+                        size_t slot = rng()%SLOTS;
+                        size_t size = 16 + rng()%497;
+                        free(slots[slot]);
+                        slots[slot] = malloc(size);
+                        touch(slots[slot], size);
+                    }
+                    count += 64;
+                }
+                ops.fetch_add(count, std::memory_order_relaxed);
+            });
+        }
+        for (auto& slots : arrays)
+        {
+            for (void* ptr : slots) free(ptr);
+        }
+        printf("larson: %zu threads, %.2f Mops/s\n", options.threads, static_cast<double>(ops.load()) / elapsed / 1e6);
+    }
+
+    // xmalloc-test: half the threads allocate batches and queue them, the other half free them
+    void runXmalloc(const Options& options)
+    {
+        constexpr size_t BATCH = 256;
+        size_t producers = std::max<size_t>(1, options.threads/2);
+        std::mutex queueMutex;
+        std::vector<void**> queue;
+        std::atomic<bool> stop{false};
+        std::atomic<uint64_t> freed{0};
+
+        std::thread timer([&]
+        {
+            std::this_thread::sleep_for(std::chrono::duration<double>(options.seconds));
+            stop.store(true);
+        });
+        double elapsed = runThreads(2*producers, [&](size_t id)
+        {
+            std::mt19937_64 rng(id);
+            if (id < producers)
+            {
+                while (!stop.load(std::memory_order_relaxed))
+                {
+                    auto** batch = static_cast<void**>(malloc(BATCH*sizeof(void*)));
+                    for (size_t i = 0; i < BATCH; ++i)
+                    {
+                        size_t size = 8 + rng()%121;
+                        batch[i] = malloc(size);
+                        touch(batch[i], size);
+                    }
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    queue.push_back(batch);
+                }
+                return;
+            }
+            for (;;)
+            {
+                void** batch = nullptr;
+                {
+                    std::lock_guard<std::mutex> lock(queueMutex);
+                    if (!queue.empty())
+                    {
+                        batch = queue.back();
+                        queue.pop_back();
+                    }
+                }
+                if (!batch)
+                {
+                    if (stop.load(std::memory_order_relaxed)) return;
+                    std::this_thread::yield();
+                    continue;
+                }
+                for (size_t i = 0; i < BATCH; ++i) free(batch[i]);
+                free(batch);
+                freed.fetch_add(BATCH, std::memory_order_relaxed);
+            }
+        });
+        timer.join();
+        // whatever the consumers left behind
+        for (void** batch : queue)
+        {
+            for (size_t i = 0; i < BATCH; ++i) free(batch[i]);
+            free(batch);
+        }
+        printf("xmalloc-test: %zu producers, %zu consumers, %.2f M cross-thread frees/s\n", producers, producers,
+               static_cast<double>(freed.load()) / elapsed / 1e6);
+    }
+
+    // cache-scratch: each thread starts from a tiny blk allocated next to its neighbours' by the main thread,
+    // frees it and keeps allocating that size; writes stay slow if the allocator hands back a shared cache line
+    void runCacheScratch(const Options& options)
+    {
+        constexpr size_t OBJECT_SIZE = 8;
+        constexpr size_t ITERATIONS = 100000;
+        constexpr size_t WRITES = 100;
+        std::vector<void*> initial(options.threads);
+        for (void*& ptr : initial) ptr = malloc(OBJECT_SIZE);
+
+        double elapsed = runThreads(options.threads, [&](size_t id)
+        {
+            free(initial[id]);
+            for (size_t i = 0; i < ITERATIONS; ++i)
+            {
+                auto* object = static_cast<volatile char*>(malloc(OBJECT_SIZE));
+                for (size_t write = 0; write < WRITES; ++write)
+                {
+                    for (size_t byte = 0; byte < OBJECT_SIZE; ++byte) object[byte] = static_cast<char>(object[byte]+1);
+                }
+                free(const_cast<char*>(object));
+            }
+        });
+        printf("cache-scratch: %zu threads, %.3f s\n", options.threads, elapsed);
+    }
+
+    // alternate phases of small and larger blks, freeing most of each, and watch how much of the resident
+    // memory is still live; a fragmenting heap keeps rss high after the frees
+    void runFragmentation(const Options& options)
+    {
+        constexpr size_t PHASES = 8;
+        auto target = static_cast<size_t>(64.0*1024*1024 * options.scale);
+        std::mt19937_64 rng(7);
+        std::vector<std::pair<void*, size_t>> live;
+        size_t liveBytes = 0;
+
+        printf("fragmentation: phase, live MB, rss MB, rss/live\n");
+        for (size_t phase = 0; phase < PHASES; ++phase)
+        {
+            bool smallPhase = phase%2 == 0;
+            size_t phaseStart = live.size();
+            for (size_t allocated = 0; allocated < target/2;)
+            {
+                size_t size = smallPhase ? drawLogUniform(rng, 16, 512) : drawLogUniform(rng, 1024, 16*1024);
+                void* ptr = malloc(size);
+                touch(ptr, size);
+                live.emplace_back(ptr, size);
+                liveBytes += size;
+                allocated += size;
+            }
+            // free a random 90% of the phase, the survivors stay for good and pin pages all over the heap
+            std::shuffle(live.begin()+static_cast<std::ptrdiff_t>(phaseStart), live.end(), rng);
+            size_t keep = phaseStart + (live.size()-phaseStart)/10;
+            for (size_t i = keep; i < live.size(); ++i)
+            {
+                free(live[i].first);
+                liveBytes -= live[i].second;
+            }
+            live.resize(keep);
+
+            size_t rss = residentBytes();
+            printf("  %zu  %8.1f  %8.1f  %6.2f\n", phase, static_cast<double>(liveBytes)/1048576,
+                   static_cast<double>(rss)/1048576, static_cast<double>(rss)/static_cast<double>(std::max<size_t>(liveBytes, 1)));
+        }
+        for (auto& [ptr, size] : live) free(ptr);
+    }
+
+    // replays a recorded trace on one thread in timestamp order; blks from before the recording started
+    // are skipped when freed
+    bool runReplay(const char* path)
+    {
+        std::ifstream file(path, std::ios::binary);
+        AllocationTraceHeader header{};
+        if (!file.read(reinterpret_cast<char*>(&header), sizeof(header)) || memcmp(header.magic, TRACE_MAGIC, sizeof(TRACE_MAGIC)) != 0
+            || header.version != TRACE_VERSION || header.recordSize < sizeof(AllocationTraceRecord))
+        {
+            fprintf(stderr, "%s: not an allocation trace\n", path);
+            return false;
+        }
+
+        std::vector<AllocationTraceRecord> records;
+        std::vector<char> buffer(header.recordSize);
+        while (file.read(buffer.data(), static_cast<std::streamsize>(buffer.size())))
+        {
+            AllocationTraceRecord record;
+            memcpy(&record, buffer.data(), sizeof(record));
+            records.push_back(record);
+        }
+        // each thread's records are already in order, the stable sort keeps ties that way
+        std::stable_sort(records.begin(), records.end(), [](const auto& a, const auto& b) { return a.timestampNanos < b.timestampNanos; });
+
+        std::unordered_map<uint64_t, void*> live;
+        live.reserve(records.size());
+        LatencyHistogram latencies[static_cast<size_t>(TraceOp::Free)+1];
+        size_t unknownFrees = 0;
+        uint64_t start = nowNanos();
+        for (const AllocationTraceRecord& record : records)
+        {
+            void* ptr = nullptr;
+            void* old = nullptr;
+            if (record.op == TraceOp::Free || record.op == TraceOp::Realloc)
+            {
+                uint64_t id = record.op == TraceOp::Free ? record.ptr : record.oldPtr;
+                auto it = id ? live.find(id) : live.end();
+                if (id && it == live.end())
+                {
+                    ++unknownFrees;
+                    continue;
+                }
+                if (it != live.end())
+                {
+                    old = it->second;
+                    live.erase(it);
+                }
+            }
+
+            uint64_t before = nowNanos();
+            switch (record.op)
+            {
+            case TraceOp::Malloc: ptr = malloc(record.size); break;
+            case TraceOp::Calloc: ptr = calloc(1, record.size); break;
+            case TraceOp::Realloc:
+                if (record.size) ptr = realloc(old, record.size);
+                else free(old);
+                break;
+            case TraceOp::AlignedAlloc:
+            {
+                size_t alignment = size_t{1} << record.alignmentLog2;
+                if (posix_memalign(&ptr, std::max(alignment, sizeof(void*)), record.size) != 0) ptr = nullptr;
+                break;
+            }
+            case TraceOp::Free: free(old); break;
+            }
+            latencies[static_cast<size_t>(record.op)].record(nowNanos()-before);
+
+            if (ptr)
+            {
+                touch(ptr, record.size);
+                live[record.ptr] = ptr;
+            }
+        }
+        double elapsed = static_cast<double>(nowNanos()-start) / 1e9;
+        size_t endRss = residentBytes();
+        for (auto& [id, ptr] : live) free(ptr);
+
+        printf("replay %s: %zu ops in %.3f s, %zu frees of unknown blks, peak rss %zu KB, rss at end %zu KB\n", path,
+               records.size(), elapsed, unknownFrees, peakResidentBytes()/1024, endRss/1024);
+        latencies[static_cast<size_t>(TraceOp::Malloc)].print("malloc");
+        latencies[static_cast<size_t>(TraceOp::Calloc)].print("calloc");
+        latencies[static_cast<size_t>(TraceOp::Realloc)].print("realloc");
+        latencies[static_cast<size_t>(TraceOp::AlignedAlloc)].print("aligned");
+        latencies[static_cast<size_t>(TraceOp::Free)].print("free");
+        return true;
+    }
+
+    void printUsage(const char* program)
+    {
+        fprintf(stderr, "usage: %s [--threads N] [--seconds S] [--scale X] [latency|larson|xmalloc|cache-scratch|fragmentation|replay=<trace>]...\n"
+                        "runs everything but replay by default; pick the allocator with LD_PRELOAD\n", program);
+    }
+}
+
+int main(int argc, char** argv)
+{
+    Options options;
+    std::vector<std::string> benchmarks;
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if ((arg == "--threads" || arg == "--seconds" || arg == "--scale") && i+1 < argc)
+        {
+            double value = atof(argv[++i]);
+            if (arg == "--threads") options.threads = std::max<size_t>(1, static_cast<size_t>(value));
+            else if (arg == "--seconds") options.seconds = value;
+            else options.scale = value;
+        }
+        else if (arg.starts_with("--"))
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+        else benchmarks.push_back(arg);
+    }
+    if (benchmarks.empty()) benchmarks = {"latency", "larson", "xmalloc", "cache-scratch", "fragmentation"};
+
+    const char* preload = getenv("LD_PRELOAD");
+    printf("allocator: %s\n", preload && *preload ? preload : "libc");
+    for (const std::string& benchmark : benchmarks)
+    {
+        if (benchmark == "latency") runLatency(options);
+        else if (benchmark == "larson") runLarson(options);
+        else if (benchmark == "xmalloc") runXmalloc(options);
+        else if (benchmark == "cache-scratch") runCacheScratch(options);
+        else if (benchmark == "fragmentation") runFragmentation(options);
+        else if (benchmark.starts_with("replay="))
+        {
+            if (!runReplay(benchmark.c_str()+7)) return 1;
+        }
+        else
+        {
+            printUsage(argv[0]);
+            return 2;
+        }
+        fflush(stdout);
+    }
+    return 0;
+}
@@ -0,0 +1,307 @@
+// drop-in replacement for the libc allocator, e.g. LD_PRELOAD=./libsbrkmalloc.so ./app
+#include <new>
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include "SbrkMemoryAllocator.h"
+
+namespace
+{
+    // built in static storage on first use: allocations can come before static init, from the dynamic
+    // loader or other libraries' constructors, and there is no destructor to run after frees at exit
+    SbrkMemoryAllocator<>& getAllocator()
+    {
+        alignas(SbrkMemoryAllocator<>) static unsigned char storage[sizeof(SbrkMemoryAllocator<>)];
+        static SbrkMemoryAllocator<>* allocator = new (storage) SbrkMemoryAllocator<>();
+        return *allocator;
+    }
+
+    // registered once the library is loaded rather than from getAllocator(), pthread_atfork may allocate
+    __attribute__((constructor)) void registerForkHandlers()
+    {
+        pthread_atfork([] { getAllocator().lockForFork(); },
+                       [] { getAllocator().unlockAfterFork(); },
+                       [] { getAllocator().unlockAfterForkInChild(); });
+    }
+
+    // SBRKMALLOC_NUMA=1 keeps each thread on the arenas of its NUMA node, whose chunks are bound to it
+    __attribute__((constructor)) void selectNumaArenas()
+    {
+        const char* numa = getenv("SBRKMALLOC_NUMA");
+        if (numa && *numa == '1') getAllocator().setArenaSelection(SbrkMemoryAllocator<>::ArenaSelection::PerNode);
+    }
+
+    // SBRKMALLOC_PROFILE=<prefix> samples one allocation per SBRKMALLOC_SAMPLE_RATE bytes (512KB by default) and
+    // writes the ones still live at exit to <prefix>.<pid>.heap, for `pprof <program> <file>`
+    const char* profilePrefix = nullptr;
+
+    __attribute__((constructor)) void startHeapProfiler()
+    {
+        profilePrefix = getenv("SBRKMALLOC_PROFILE");
+        if (!profilePrefix || !*profilePrefix) return;
+        const char* rate = getenv("SBRKMALLOC_SAMPLE_RATE");
+        getAllocator().setProfileSampleRate(rate ? strtoull(rate, nullptr, 10) : SbrkMemoryAllocator<>::DEFAULT_PROFILE_SAMPLE_RATE);
+    }
+
+    __attribute__((destructor)) void writeHeapProfile()
+    {
+        if (!profilePrefix || !*profilePrefix) return;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.%d.heap", profilePrefix, getpid());
+        int fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+        if (fd < 0) return;
+        getAllocator().dumpHeapProfile(fd);
+        close(fd);
+    }
+
+    // SBRKMALLOC_TRACE=<prefix> records every allocation and free to <prefix>.<pid>.trace, for
+    // `malloc_bench replay=<file>`; forked children don't carry on with the parent's trace
+    __attribute__((constructor)) void startAllocationTrace()
+    {
+        const char* prefix = getenv("SBRKMALLOC_TRACE");
+        if (!prefix || !*prefix) return;
+        char path[4096];
+        snprintf(path, sizeof(path), "%s.%d.trace", prefix, getpid());
+        getAllocator().startTrace(path);
+    }
+
+    __attribute__((destructor)) void stopAllocationTrace()
+    {
+        getAllocator().stopTrace();
+    }
+
+    void* allocateOrThrow(size_t size)
+    {
+        for (;;)
+        {
+            if (void* ptr = getAllocator().malloc(size)) return ptr;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* allocateAlignedOrThrow(size_t size, std::align_val_t alignment)
+    {
+        for (;;)
+        {
+            if (void* ptr = getAllocator().aligned_alloc(static_cast<size_t>(alignment), size)) return ptr;
+            std::new_handler handler = std::get_new_handler();
+            if (!handler) throw std::bad_alloc();
+            handler();
+        }
+    }
+
+    void* setErrnoOnFailure(void* ptr)
+    {
+        if (!ptr) errno = ENOMEM;
+        return ptr;
+    }
+}
+
+#define SBRK_EXPORT extern "C" __attribute__((visibility("default")))
+
+SBRK_EXPORT void* malloc(size_t size) noexcept
+{
+    return setErrnoOnFailure(getAllocator().malloc(size));
+}
+
+SBRK_EXPORT void free(void* ptr) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+SBRK_EXPORT void free_sized(void* ptr, size_t size) noexcept
+{
+    getAllocator().free_sized(ptr, size);
+}
+
+SBRK_EXPORT void free_aligned_sized(void* ptr, size_t alignment, size_t size) noexcept
+{
+    getAllocator().free_aligned_sized(ptr, alignment, size);
+}
+
+SBRK_EXPORT void* calloc(size_t count, size_t size) noexcept
+{
+    return getAllocator().calloc(count, size);
+}
+
+SBRK_EXPORT void* realloc(void* ptr, size_t size) noexcept
+{
+    void* newPtr = getAllocator().realloc(ptr, size);
+    return size ? setErrnoOnFailure(newPtr) : newPtr;
+}
+
+// libc's own reallocarray would hand a blk of ours to its realloc
+SBRK_EXPORT void* reallocarray(void* ptr, size_t count, size_t size) noexcept
+{
+    size_t totalSize;
+    if (__builtin_mul_overflow(count, size, &totalSize))
+    {
+        errno = ENOMEM;
+        return nullptr;
+    }
+    return realloc(ptr, totalSize);
+}
+
+SBRK_EXPORT int posix_memalign(void** memptr, size_t alignment, size_t size) noexcept
+{
+    return getAllocator().posix_memalign(memptr, alignment, size);
+}
+
+SBRK_EXPORT void* aligned_alloc(size_t alignment, size_t size) noexcept
+{
+    void* ptr = getAllocator().aligned_alloc(alignment, size);
+    if (!ptr) errno = std::has_single_bit(alignment) ? ENOMEM : EINVAL;
+    return ptr;
+}
+
+SBRK_EXPORT void* memalign(size_t alignment, size_t size) noexcept
+{
+    return setErrnoOnFailure(getAllocator().memalign(alignment, size));
+}
+
+SBRK_EXPORT void* valloc(size_t size) noexcept
+{
+    return setErrnoOnFailure(getAllocator().aligned_alloc(static_cast<size_t>(sysconf(_SC_PAGESIZE)), size));
+}
+
+SBRK_EXPORT void* pvalloc(size_t size) noexcept
+{
+    auto pageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    return setErrnoOnFailure(getAllocator().aligned_alloc(pageSize, (size + pageSize-1) & ~(pageSize-1)));
+}
+
+SBRK_EXPORT size_t malloc_usable_size(void* ptr) noexcept
+{
+    return getAllocator().malloc_usable_size(ptr);
+}
+
+// bursts of same-sized objects, returns how many of `count` were allocated
+SBRK_EXPORT size_t malloc_batch(size_t size, size_t count, void** out) noexcept
+{
+    return getAllocator().mallocBatch(size, count, out);
+}
+
+SBRK_EXPORT void free_batch(void** ptrs, size_t count) noexcept
+{
+    getAllocator().freeBatch(ptrs, count);
+}
+
+SBRK_EXPORT int malloc_trim(size_t pad) noexcept
+{
+    return getAllocator().malloc_trim(pad);
+}
+
+SBRK_EXPORT struct mallinfo2 mallinfo2() noexcept
+{
+    auto info = getAllocator().mallinfo2();
+    return {info.arena, info.ordblks, info.smblks, info.hblks, info.hblkhd, info.usmblks, info.fsmblks,
+            info.uordblks, info.fordblks, info.keepcost};
+}
+
+// glibc prints a table to stderr, this prints the JSON dump there instead
+SBRK_EXPORT void malloc_stats() noexcept
+{
+    getAllocator().dumpStats(STDERR_FILENO);
+}
+
+void* operator new(size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void* operator new[](size_t size)
+{
+    return allocateOrThrow(size);
+}
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept
+{
+    return getAllocator().malloc(size);
+}
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept
+{
+    return getAllocator().malloc(size);
+}
+
+void* operator new(size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, alignment);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment)
+{
+    return allocateAlignedOrThrow(size, alignment);
+}
+
+void* operator new(size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return getAllocator().aligned_alloc(static_cast<size_t>(alignment), size);
+}
+
+void* operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t&) noexcept
+{
+    return getAllocator().aligned_alloc(static_cast<size_t>(alignment), size);
+}
+
+void operator delete(void* ptr) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete[](void* ptr) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete(void* ptr, size_t size) noexcept
+{
+    getAllocator().free_sized(ptr, size);
+}
+
+void operator delete[](void* ptr, size_t size) noexcept
+{
+    getAllocator().free_sized(ptr, size);
+}
+
+void operator delete(void* ptr, const std::nothrow_t&) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete[](void* ptr, const std::nothrow_t&) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete(void* ptr, std::align_val_t) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete(void* ptr, size_t size, std::align_val_t alignment) noexcept
+{
+    getAllocator().free_aligned_sized(ptr, static_cast<size_t>(alignment), size);
+}
+
+void operator delete[](void* ptr, size_t size, std::align_val_t alignment) noexcept
+{
+    getAllocator().free_aligned_sized(ptr, static_cast<size_t>(alignment), size);
+}
+
+void operator delete(void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    getAllocator().free(ptr);
+}
+
+void operator delete[](void* ptr, std::align_val_t, const std::nothrow_t&) noexcept
+{
+    getAllocator().free(ptr);
+}